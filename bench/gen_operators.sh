@@ -0,0 +1,15 @@
+#!/bin/sh
+# Écrit sur la sortie standard un programme de n opérateurs, chacun appelant
+# le précédent, pour mesurer le lexer et le parser sur une grosse entrée.
+# usage : bench/gen_operators.sh [n]
+awk -v n="${1:-100000}" 'BEGIN {
+    print "operator (x .op0 y)\n    return (x + y);\n"
+    for (i = 1; i < n; i++) {
+        printf "operator (x .op%d y)\n", i
+        print "    let a = ((x * 31) + (y - 7));"
+        print "    let b = ((a * a) - (x * 3));"
+        print "    [8] = ((b + a) * (x + 1));"
+        printf "    return if (a < b) then ((b / 2) .op%d (a + [3])) else ((a - b) + [8]);\n\n", i-1
+    }
+    printf "operator (:main)\n    return (1 .op%d 2);\n", n-1
+}'
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Débit du lexer et du parser en lexèmes par seconde, d'après --stats, sur
+# le programme de bench/gen_operators.sh.
+# usage : bench/parse_throughput.sh [compilateur] [n]
+#
+# Pour n = 100000 (9,4M lexèmes), le parser passe de 242 000 lexèmes/s
+# (38,8 s), quand la fin d'une liste d'expressions était détectée par une
+# exception, à 1 270 000 lexèmes/s (7,4 s) avec un lexème d'avance.
+TIPE=$(realpath "${1:-./build/tipe}")
+DIR=$(dirname "$0")
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+"$DIR"/gen_operators.sh "${2:-100000}" > "$TMP/ops.tipe"
+# le code produit n'est pas exécuté, on compile dans le dossier temporaire
+(cd "$TMP" && "$TIPE" --stats ops.tipe 2>&1 >/dev/null) 2>/dev/null \
+    | sed -n 's/^\(lex\|parse\): \([0-9.]*\) ms (\([0-9]*\) tokens\/s)$/\1 \2 \3/p' \
+    | awk '{ printf "%-6s %10.1f ms %12d tokens/s\n", $1, $2, $3 }'
@@ -0,0 +1,14 @@
+#!/bin/sh
+# Compare le temps d'exécution du code natif (--run) et de la machine
+# virtuelle (--vm) sur chaque programme du dossier, d'après --stats.
+# usage : bench/vm_vs_native.sh [compilateur]
+TIPE=${1:-./build/tipe}
+DIR=$(dirname "$0")
+# la récursion non terminale demande plus que la pile par défaut
+ulimit -s unlimited 2>/dev/null
+printf '%-12s %12s %12s %8s\n' program native_ms vm_ms ratio
+for f in "$DIR"/*.tipe; do
+    native=$("$TIPE" --stats --run "$f" 2>&1 >/dev/null | sed -n 's/^run: \([0-9.]*\) ms$/\1/p')
+    vm=$("$TIPE" --stats --vm "$f" 2>&1 >/dev/null | sed -n 's/^run: \([0-9.]*\) ms$/\1/p')
+    echo "$(basename "$f" .tipe) $native $vm" | awk '{ printf "%-12s %12.1f %12.1f %8.1f\n", $1, $2, $3, $3/$2 }'
+done
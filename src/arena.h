@@ -0,0 +1,100 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// tableau de taille fixe alloué dans une Arena
+template <typename T>
+class Span{
+    public :
+        T* data = nullptr;
+        uint32_t count = 0;
+
+        T* begin() const { return data; }
+        T* end() const { return data + count; }
+        size_t size() const { return count; }
+        bool empty() const { return !count; }
+        T& operator[](size_t i) const { return data[i]; }
+};
+
+// Allocateur par incrément de pointeur : tous les objets sont libérés en
+// même temps que l'arène, sans appel de destructeur. Seuls des types
+// trivialement destructibles peuvent donc y être alloués.
+class Arena{
+    private :
+        static constexpr size_t first_chunk_size = 1 << 16;
+        static constexpr size_t max_chunk_size = 1 << 24;
+        vector<unique_ptr<char[]>> m_chunks;
+        char* m_curr = nullptr;
+        char* m_end = nullptr;
+        size_t m_next_chunk_size = first_chunk_size;
+        size_t m_allocated = 0, m_used = 0, m_objects = 0;
+
+        void* alloc(size_t size, size_t align) {
+            uintptr_t curr = ((uintptr_t)m_curr + align-1) & ~(uintptr_t)(align-1);
+            if (!m_curr || curr + size > (uintptr_t)m_end) {
+                size_t chunk_size = size + align > m_next_chunk_size ? size + align : m_next_chunk_size;
+                m_chunks.emplace_back(new char[chunk_size]);
+                m_curr = m_chunks.back().get();
+                m_end = m_curr + chunk_size;
+                m_allocated += chunk_size;
+                if (m_next_chunk_size < max_chunk_size) m_next_chunk_size *= 2;
+                curr = ((uintptr_t)m_curr + align-1) & ~(uintptr_t)(align-1);
+            }
+            m_curr = (char*)(curr + size);
+            m_used += size;
+            return (void*)curr;
+        }
+
+    public :
+        Arena() = default;
+        Arena(Arena&&) = default;
+        Arena& operator=(Arena&&) = default;
+
+        template <typename T, typename... Args>
+        T* make(Args&&... args) {
+            static_assert(is_trivially_destructible_v<T>, "arena objects are never destroyed");
+            m_objects++;
+            return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        // copie [first, last) dans l'arène
+        template <typename It>
+        auto copy(It first, It last) {
+            using T = typename iterator_traits<It>::value_type;
+            static_assert(is_trivially_destructible_v<T>, "arena objects are never destroyed");
+            Span<T> res;
+            res.count = last - first;
+            if (!res.count) return res;
+            res.data = (T*)alloc(sizeof(T)*res.count, alignof(T));
+            for (uint32_t i = 0; first != last; ++first, ++i)
+                new (res.data + i) T(*first);
+            return res;
+        }
+
+        // récupère les blocs de other, qui peuvent alors lui survivre
+        void absorb(Arena&& other) {
+            for (auto& chunk : other.m_chunks)
+                m_chunks.push_back(std::move(chunk));
+            m_allocated += other.m_allocated;
+            m_used += other.m_used;
+            m_objects += other.m_objects;
+            other = Arena();
+        }
+
+        size_t chunks_nb() const { return m_chunks.size(); }
+        size_t bytes_allocated() const { return m_allocated; }
+        size_t bytes_used() const { return m_used; }
+        size_t objects_nb() const { return m_objects; }
+};
+
+#endif
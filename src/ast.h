@@ -3,13 +3,13 @@
 
 #include "parser.h"
 #include "codegen.h"
-
-#include <fstream>
-#include <memory>
+#include "arena.h"
+#include "ir.h"
 
 class Node {
     public :
-        virtual void codegen(ofstream& out, Environement& env) = 0;
+        // traduit le noeud en IR et renvoie sa valeur
+        virtual Value lower(IRBuilder& ir, Environement& env) = 0;
 };
 
 class Expr : public Node {};
@@ -20,49 +20,53 @@ class RvalToken : public Rvalue {
     public :
         Token id;
         RvalToken(const Token& id);
-        virtual void codegen(ofstream& out, Environement& env) override;
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
 };
 
+// accès à width octets du tape à partir de index, en little endian
 class RvalAccess : public Rvalue {
     public :
-        unique_ptr<Expr> index;
-        RvalAccess(unique_ptr<Expr>&& index);
-        virtual void codegen(ofstream& out, Environement& env) override;
+        Expr* index;
+        int width;
+        RvalAccess(Expr* index, int width = 1);
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
 };
 
 class OpApply : public Expr {
     public :
         Token op;
-        vector<unique_ptr<Expr>> lhs, rhs;
+        Span<Expr*> lhs, rhs;
         OpApply(const Token& op,
-                vector<unique_ptr<Expr>>&& lhs,
-                vector<unique_ptr<Expr>>&& rhs);
-        virtual void codegen(ofstream& out, Environement& env) override;
+                Span<Expr*> lhs,
+                Span<Expr*> rhs);
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
 };
 
 class Lvalue : public Node {
     public :
-        virtual string get_name(Environement& env) = 0;
+        // écrit val dans la variable ou la case du ruban désignée
+        virtual void lower_store(IRBuilder& ir, Environement& env, Value val) = 0;
         virtual int size() = 0;
 };
 
 class Var : public Lvalue {
     public :
         Token id;
-        int offset;
+        int vreg;
         Var(const Token& id);
-        virtual void codegen(ofstream& out, Environement& env) override;
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
         void define_in_scope(Environement& env);
-        string get_name(Environement& env) override;
+        void lower_store(IRBuilder& ir, Environement& env, Value val) override;
         int size() override;
 };
 
 class LvalAccess : public Lvalue {
     public :
-        unique_ptr<Expr> index;
-        LvalAccess(unique_ptr<Expr>&& index);
-        virtual void codegen(ofstream& out, Environement& env) override;
-        string get_name(Environement& env) override;
+        Expr* index;
+        int width;
+        LvalAccess(Expr* index, int width = 1);
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
+        void lower_store(IRBuilder& ir, Environement& env, Value val) override;
         int size() override;
 };
 
@@ -70,73 +74,82 @@ class Statement : public Node {};
 
 class FuncCall : public Statement {
     public :
-        unique_ptr<Expr> expr;
-        FuncCall(unique_ptr<Expr>&& expr);
-        virtual void codegen(ofstream& out, Environement& env) override;
+        Expr* expr;
+        FuncCall(Expr* expr);
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
 };
 
 class Define : public Statement {
     public :
-        unique_ptr<Var> lval;
-        unique_ptr<Expr> expr;
-        Define(unique_ptr<Var>&& lval, unique_ptr<Expr>&& expr);
-        virtual void codegen(ofstream& out, Environement& env) override;
+        Var* lval;
+        Expr* expr;
+        Define(Var* lval, Expr* expr);
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
 };
 
 class Assign : public Statement {
     public :
-        unique_ptr<Lvalue> lval;
-        unique_ptr<Expr> expr;
-        Assign(unique_ptr<Lvalue>&& lval, unique_ptr<Expr>&& expr);
-        virtual void codegen(ofstream& out, Environement& env) override;
+        Lvalue* lval;
+        Expr* expr;
+        Assign(Lvalue* lval, Expr* expr);
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
 };
 
 class Return : public Statement {
     public :
-        unique_ptr<Expr> expr;
-        Return(unique_ptr<Expr>&& expr);
-        virtual void codegen(ofstream& out, Environement& env) override;
+        Expr* expr;
+        Return(Expr* expr);
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
 };
 
 class IfStatement : public Expr {
     public :
-        unique_ptr<Expr> cond;
-        unique_ptr<Expr> expr_true;
-        unique_ptr<Expr> expr_false;
-        IfStatement(unique_ptr<Expr>&& cond,
-                unique_ptr<Expr>&& expr_true,
-                unique_ptr<Expr>&& expr_false);
-        virtual void codegen(ofstream& out, Environement& env) override;
-        static int branch_count;
+        Expr* cond;
+        Expr* expr_true;
+        Expr* expr_false;
+        IfStatement(Expr* cond,
+                Expr* expr_true,
+                Expr* expr_false);
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
 };
 
 class Scope : public Node {
     public :
         int int_def_nb = 0;
-        int bytes_owned = 0;
-        void init_scope(ofstream& out, Environement& env);
-        void del_scope(ofstream& out, Environement& env);
+        void init_scope(Environement& env);
+        void del_scope(Environement& env);
 };
 
 class OpDef : public Scope {
     public :
         Token op;
-        vector<unique_ptr<Var>> lhs_args, rhs_args;
-        vector<unique_ptr<Statement>> statements;
+        Span<Var*> lhs_args, rhs_args;
+        Span<Statement*> statements;
+        // numéro de l'operator, attribué par declare
+        int id = -1;
         OpDef(const Token& op,
-                vector<unique_ptr<Var>>&& lhs_args,
-                vector<unique_ptr<Var>>&& rhs_args,
-                vector<unique_ptr<Statement>>&& statements);
-        virtual void codegen(ofstream& out, Environement& env) override;
+                Span<Var*> lhs_args,
+                Span<Var*> rhs_args,
+                Span<Statement*> statements);
+        // enregistre la signature, avant la traduction de tout operator
+        void declare(Environement& env);
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
 };
 
+// tous les noeuds de l'AST sont alloués dans son arène
 class AST : public Scope {
     public :
-        vector<unique_ptr<OpDef>> ops;
-        AST(vector<unique_ptr<OpDef>>&& ops);
-        virtual void codegen(ofstream& out, Environement& env) override;
+        Arena arena;
+        Span<OpDef*> ops;
+        AST(Arena&& arena, Span<OpDef*> ops);
+        virtual Value lower(IRBuilder& ir, Environement& env) override;
 };
 
 AST toAST(const parseTree& tree);
+// construit l'AST en une seule passe, sans construire de parseTree
+AST parseAST(const vector<Token>& tokens);
+class ThreadPool;
+// découpe tokens avant chaque "operator" et construit les OpDef en parallèle
+AST parseAST(const vector<Token>& tokens, ThreadPool& pool);
 
 #endif
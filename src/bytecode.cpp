@@ -0,0 +1,378 @@
+#include "bytecode.h"
+#include "source.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+static const char bytecode_magic[8] = {'T', 'I', 'P', 'E', 'B', 'C', '4', '\0'};
+
+// opcode de la forme RR de op, la forme RI le suit
+static int64_t binop_code(IROp op) {
+    switch (op) {
+#define X(name) case IROp::name: return BC_##name##_RR;
+        BC_BINOPS(X)
+#undef X
+        default: return -1;
+    }
+}
+
+static int64_t branch_code(IROp cond) {
+    switch (cond) {
+#define X(name) case IROp::name: return BC_BR_##name##_RR;
+        BC_CONDS(X)
+#undef X
+        default: return -1;
+    }
+}
+
+static bool is_commutative(IROp op) {
+    return op == IROp::ADD || op == IROp::MUL || op == IROp::AND || op == IROp::OR
+        || op == IROp::EQ || op == IROp::NE;
+}
+
+// traduction d'une fonction ; les trois registres qui suivent ceux de l'IR
+// reçoivent les constantes qu'une instruction n'accepte qu'en registre
+class FunctionCompiler{
+    private :
+        const IRFunction& m_func;
+        vector<int64_t>& m_code;
+        const int m_size;
+        // positions des cibles de saut à remplacer par celle du bloc
+        vector<pair<size_t, int>> m_block_fixups;
+
+        void emit(initializer_list<int64_t> words) {
+            m_code.insert(m_code.end(), words);
+        }
+
+        int64_t reg(Value val, int scratch) {
+            if (val.is_vreg()) return val.val;
+            emit({BC_MOV_I, m_func.vregs_nb + scratch, val.val});
+            return m_func.vregs_nb + scratch;
+        }
+
+        void target(int block) {
+            m_block_fixups.push_back({m_code.size(), block});
+            m_code.push_back(0);
+        }
+
+        void args(const Instr& instr) {
+            m_code.push_back(instr.args.size());
+            for (const Value& arg : instr.args)
+                emit({arg.is_imm(), arg.val});
+        }
+
+        void instr(const Instr& instr) {
+            Value a = instr.a, b = instr.b;
+            int64_t dst = instr.dst.is_vreg() ? instr.dst.val : m_func.vregs_nb;
+            switch (instr.op) {
+                case IROp::COPY:
+                    if (a.is_imm()) emit({BC_MOV_I, dst, a.val});
+                    else if (a.val != dst) emit({BC_MOV_R, dst, a.val});
+                    break;
+                case IROp::ARG:
+                    emit({BC_ARG, dst, a.val});
+                    break;
+                case IROp::LOAD:
+                    if (instr.width == 1) emit({a.is_imm() ? BC_LOAD_I : BC_LOAD_R, dst, a.val});
+                    else emit({a.is_imm() ? BC_LOADW_I : BC_LOADW_R, dst, a.val, instr.width});
+                    break;
+                case IROp::STORE: {
+                    int64_t src = reg(b, 0);
+                    if (instr.width == 1) emit({a.is_imm() ? BC_STORE_I : BC_STORE_R, a.val, src});
+                    else emit({a.is_imm() ? BC_STOREW_I : BC_STOREW_R, a.val, src, instr.width});
+                    break;
+                }
+                case IROp::MLOAD:
+                    emit({BC_MLOAD, dst, reg(a, 0)});
+                    break;
+                case IROp::MSTORE: {
+                    int64_t addr = reg(a, 0), src = reg(b, 1);
+                    emit({BC_MSTORE, addr, src});
+                    break;
+                }
+                case IROp::PRINT: case IROp::READ: {
+                    int64_t addr = reg(a, 0), len = reg(b, 1);
+                    emit({instr.op == IROp::PRINT ? BC_PRINT : BC_READ, dst, addr, len});
+                    break;
+                }
+                case IROp::FLUSH:
+                    emit({BC_FLUSH, dst});
+                    break;
+                case IROp::MEMCPY: case IROp::MEMSET: case IROp::MEMCHR: case IROp::MEMCMP: {
+                    int64_t r0 = reg(instr.args[0], 0), r1 = reg(instr.args[1], 1), r2 = reg(instr.args[2], 2);
+                    emit({BC_MEMCPY + (int)instr.op - (int)IROp::MEMCPY, dst, r0, r1, r2});
+                    break;
+                }
+                case IROp::CALL:
+                    emit({BC_CALL, instr.callee, dst, m_size});
+                    args(instr);
+                    break;
+                case IROp::TAILCALL:
+                    emit({BC_TAILCALL, instr.callee, m_size});
+                    args(instr);
+                    break;
+                case IROp::RET:
+                    emit({a.is_imm() ? BC_RET_I : BC_RET_R, a.val});
+                    break;
+                case IROp::JMP:
+                    m_code.push_back(BC_JMP);
+                    target(instr.target);
+                    break;
+                case IROp::BR: {
+                    IROp cond = instr.cond;
+                    int64_t taken;
+                    if (a.is_imm() && b.is_imm() && eval_binop(cond, a.val, b.val, taken)) {
+                        m_code.push_back(BC_JMP);
+                        target(taken ? instr.target : instr.target2);
+                        break;
+                    }
+                    if (a.is_imm()) {
+                        swap(a, b);
+                        cond = swap_comparison(cond);
+                    }
+                    emit({branch_code(cond) + b.is_imm(), reg(a, 0), b.val});
+                    target(instr.target);
+                    target(instr.target2);
+                    break;
+                }
+                default: {
+                    IROp op = instr.op;
+                    if (a.is_imm() && !b.is_imm() && (is_commutative(op) || is_comparison(op))) {
+                        swap(a, b);
+                        op = swap_comparison(op);
+                    }
+                    int64_t ra = reg(a, 0);
+                    emit({binop_code(op) + b.is_imm(), dst, ra, b.val});
+                    break;
+                }
+            }
+        }
+
+    public :
+        FunctionCompiler(const IRFunction& func, vector<int64_t>& code)
+            : m_func(func), m_code(code), m_size(func.vregs_nb + 3) {}
+
+        void run() {
+            emit({BC_ENTER, m_size});
+            vector<int64_t> block_pos(m_func.blocks.size());
+            for (const BasicBlock& block : m_func.blocks) {
+                block_pos[block.id] = m_code.size();
+                for (const Instr& i : block.instrs)
+                    instr(i);
+            }
+            for (auto [pos, block] : m_block_fixups)
+                m_code[pos] = block_pos[block];
+        }
+};
+
+size_t instr_size(const int64_t* instr) {
+    switch (instr[0]) {
+        case BC_ENTER: case BC_RET_R: case BC_RET_I: case BC_JMP: case BC_FLUSH: return 2;
+        case BC_MOV_R: case BC_MOV_I: case BC_ARG:
+        case BC_LOAD_R: case BC_LOAD_I: case BC_STORE_R: case BC_STORE_I:
+        case BC_MLOAD: case BC_MSTORE: return 3;
+        case BC_LOADW_R: case BC_LOADW_I: case BC_STOREW_R: case BC_STOREW_I:
+        case BC_PRINT: case BC_READ: return 4;
+        case BC_MEMCPY: case BC_MEMSET: case BC_MEMCHR: case BC_MEMCMP: return 5;
+        case BC_CALL: return 5 + 2*instr[4];
+        case BC_TAILCALL: return 4 + 2*instr[3];
+        default:
+            // les opérations binaires précèdent BC_LOAD_R, les branchements suivent BC_JMP
+            return instr[0] < BC_LOAD_R ? 4 : 5;
+    }
+}
+
+Bytecode compile_bytecode(const IRModule& module) {
+    Bytecode bc;
+    bc.memo_size = module.memo_size;
+    bc.tape = module.tape;
+    vector<int64_t> entries(module.funcs.size(), -1);
+    for (const IRFunction& func : module.funcs) {
+        if (func.blocks.empty()) continue;
+        entries[func.id] = bc.code.size();
+        if (func.is_main) bc.entry = bc.code.size();
+        FunctionCompiler(func, bc.code).run();
+    }
+    // les appels désignaient la fonction, ils désignent maintenant son code
+    for (size_t pos = 0; pos < bc.code.size(); pos += instr_size(&bc.code[pos]))
+        if (bc.code[pos] == BC_CALL || bc.code[pos] == BC_TAILCALL)
+            bc.code[pos+1] = entries[bc.code[pos+1]];
+    return bc;
+}
+
+// taille maximale d'un cadre et nombre maximal d'arguments : l'en-tête et
+// les arguments d'un appel doivent tenir dans la marge de la pile de la VM
+#define BC_MAX_FRAME (int64_t(1) << 24)
+#define BC_MAX_ARGS (1 << 12)
+
+// vérifie qu'un bytecode chargé ne peut faire sortir la VM de ses données :
+// chaque instruction tient dans le code, le code est découpé en fonctions
+// commençant par BC_ENTER et finissant par une instruction qui ne continue
+// pas à la suivante, les registres sont dans le cadre de leur fonction, les
+// sauts restent dans la fonction et les appels visent un BC_ENTER avec
+// toujours le même nombre d'arguments, que BC_ARG ne dépasse pas
+static bool is_valid(const Bytecode& bc) {
+    const vector<int64_t>& code = bc.code;
+    int64_t size = code.size();
+    // début de la fonction de chaque instruction, -1 ailleurs
+    vector<int64_t> func_of(size, -1);
+    for (int64_t pos = 0, func = -1; pos < size; ) {
+        int64_t op = code[pos];
+        if (op < 0 || op >= BC_OPS_NB) return false;
+        if (op == BC_ENTER) func = pos;
+        if (func == -1) return false;
+        int64_t n_pos = op == BC_CALL ? pos+4 : op == BC_TAILCALL ? pos+3 : -1;
+        if (n_pos != -1 && (n_pos >= size || code[n_pos] < 0 || code[n_pos] > BC_MAX_ARGS)) return false;
+        int64_t next = pos + instr_size(&code[pos]);
+        if (next > size) return false;
+        func_of[pos] = func;
+        pos = next;
+    }
+    if (bc.entry >= size || func_of[bc.entry] != bc.entry || code[bc.entry] != BC_ENTER) return false;
+
+    // nombre d'arguments de chaque fonction, -1 tant qu'aucun appel ne la vise
+    vector<int64_t> arity(size, -1);
+    arity[bc.entry] = 0;
+    for (int64_t pos = 0; pos < size; pos += instr_size(&code[pos]))
+        if (code[pos] == BC_CALL || code[pos] == BC_TAILCALL) {
+            int64_t target = code[pos+1], n = code[pos] == BC_CALL ? code[pos+4] : code[pos+3];
+            if (target < 0 || target >= size || func_of[target] != target) return false;
+            if (arity[target] != -1 && arity[target] != n) return false;
+            arity[target] = n;
+        }
+
+    int64_t frame = 0, last = -1;
+    auto regs = [&](const int64_t* instr, initializer_list<int> indices) {
+        for (int i : indices)
+            if (instr[i] < 0 || instr[i] >= frame) return false;
+        return true;
+    };
+    auto in_func = [&](int64_t pos, int64_t target) {
+        return target >= 0 && target < size && func_of[target] == func_of[pos];
+    };
+    auto call_args = [&](const int64_t* pairs, int64_t n) {
+        for (int64_t i = 0; i < n; i++)
+            if (pairs[2*i] != 1 && (pairs[2*i] != 0 || pairs[2*i+1] < 0 || pairs[2*i+1] >= frame))
+                return false;
+        return true;
+    };
+    auto is_terminator = [&](int64_t pos) {
+        int64_t op = code[pos];
+        return op == BC_RET_R || op == BC_RET_I || op == BC_JMP || op == BC_TAILCALL || op >= BC_BR_EQ_RR;
+    };
+    for (int64_t pos = 0; pos < size; last = pos, pos += instr_size(&code[pos])) {
+        const int64_t* instr = &code[pos];
+        bool ok;
+        switch (instr[0]) {
+            case BC_ENTER:
+                if (last != -1 && !is_terminator(last)) return false;
+                frame = instr[1];
+                ok = frame > 0 && frame <= BC_MAX_FRAME;
+                break;
+            case BC_MOV_R: case BC_MLOAD: case BC_MSTORE: case BC_LOAD_R: case BC_STORE_R:
+                ok = regs(instr, {1, 2});
+                break;
+            case BC_MOV_I: case BC_LOAD_I: case BC_FLUSH: case BC_RET_R:
+                ok = regs(instr, {1});
+                break;
+            case BC_STORE_I:
+                ok = regs(instr, {2});
+                break;
+            case BC_ARG: {
+                int64_t n = arity[func_of[pos]];
+                ok = regs(instr, {1}) && instr[2] >= 0 && (n == -1 ? instr[2] < BC_MAX_ARGS : instr[2] < n);
+                break;
+            }
+            case BC_LOADW_R: case BC_STOREW_R:
+                ok = regs(instr, {1, 2}) && (instr[3] == 2 || instr[3] == 4 || instr[3] == 8);
+                break;
+            case BC_LOADW_I:
+                ok = regs(instr, {1}) && (instr[3] == 2 || instr[3] == 4 || instr[3] == 8);
+                break;
+            case BC_STOREW_I:
+                ok = regs(instr, {2}) && (instr[3] == 2 || instr[3] == 4 || instr[3] == 8);
+                break;
+            case BC_PRINT: case BC_READ:
+                ok = regs(instr, {1, 2, 3});
+                break;
+            case BC_MEMCPY: case BC_MEMSET: case BC_MEMCHR: case BC_MEMCMP:
+                ok = regs(instr, {1, 2, 3, 4});
+                break;
+            case BC_CALL:
+                ok = regs(instr, {2}) && instr[3] == frame && call_args(instr+5, instr[4]);
+                break;
+            case BC_TAILCALL:
+                ok = instr[2] == frame && call_args(instr+4, instr[3]);
+                break;
+            case BC_RET_I:
+                ok = true;
+                break;
+            case BC_JMP:
+                ok = in_func(pos, instr[1]);
+                break;
+            default:
+                if (instr[0] < BC_LOAD_R) {
+                    // opérations binaires, RR puis RI
+                    bool rr = (instr[0] - BC_ADD_RR) % 2 == 0;
+                    ok = rr ? regs(instr, {1, 2, 3}) : regs(instr, {1, 2});
+                } else {
+                    // branchements, RR puis RI
+                    bool rr = (instr[0] - BC_BR_EQ_RR) % 2 == 0;
+                    ok = (rr ? regs(instr, {1, 2}) : regs(instr, {1}))
+                        && in_func(pos, instr[3]) && in_func(pos, instr[4]);
+                }
+        }
+        if (!ok) return false;
+    }
+    return last == -1 || is_terminator(last);
+}
+
+static IOError io_error(const char* what, const char* path) {
+    return IOError(string(what) + " \"" + path + "\": " + strerror(errno));
+}
+
+void write_bytecode(const char* path, const Bytecode& bc) {
+    ofstream out{path, ios::binary};
+    if (!out) throw io_error("cannot create", path);
+    int64_t size = bc.code.size();
+    int64_t tape_flags = bc.tape.populate | bc.tape.huge_pages << 1;
+    out.write(bytecode_magic, sizeof(bytecode_magic));
+    out.write((const char*)&bc.entry, sizeof(bc.entry));
+    out.write((const char*)&bc.memo_size, sizeof(bc.memo_size));
+    out.write((const char*)&bc.tape.size, sizeof(bc.tape.size));
+    out.write((const char*)&tape_flags, sizeof(tape_flags));
+    out.write((const char*)&size, sizeof(size));
+    out.write((const char*)bc.code.data(), size*sizeof(int64_t));
+    if (!out) throw io_error("cannot write", path);
+}
+
+Bytecode read_bytecode(const char* path) {
+    ifstream in{path, ios::binary};
+    if (!in) throw io_error("cannot open", path);
+    char magic[sizeof(bytecode_magic)];
+    Bytecode bc;
+    int64_t size = 0, tape_flags = 0;
+    in.read(magic, sizeof(magic));
+    in.read((char*)&bc.entry, sizeof(bc.entry));
+    in.read((char*)&bc.memo_size, sizeof(bc.memo_size));
+    in.read((char*)&bc.tape.size, sizeof(bc.tape.size));
+    in.read((char*)&tape_flags, sizeof(tape_flags));
+    in.read((char*)&size, sizeof(size));
+    // le nombre de mots ne peut dépasser ce qui reste du fichier
+    streampos header_end = in.tellg();
+    in.seekg(0, ios::end);
+    int64_t words_left = (in.tellg() - header_end) / (streamoff)sizeof(int64_t);
+    in.seekg(header_end);
+    if (!in || memcmp(magic, bytecode_magic, sizeof(magic)) || size < 0 || bc.entry < 0 || bc.entry >= size
+        || bc.memo_size < 0 || bc.memo_size % 8 || bc.tape.size <= 0 || bc.tape.size > MAX_TAPE_SIZE)
+        throw IOError(string("not a bytecode file: \"") + path + "\"");
+    if (size > words_left) throw IOError(string("truncated bytecode file: \"") + path + "\"");
+    bc.tape.populate = tape_flags & 1;
+    bc.tape.huge_pages = tape_flags & 2;
+    bc.code.resize(size);
+    in.read((char*)bc.code.data(), size*sizeof(int64_t));
+    if (!in) throw IOError(string("truncated bytecode file: \"") + path + "\"");
+    if (!is_valid(bc)) throw IOError(string("not a bytecode file: \"") + path + "\"");
+    return bc;
+}
@@ -0,0 +1,96 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "ir.h"
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Bytecode à registres traduit depuis l'IR optimisée, exécuté par une
+// machine virtuelle : une alternative au code natif qui ne demande ni
+// assembleur ni encodage, et qu'on peut enregistrer puis recharger.
+//
+// Le code est une suite de mots de 64 bits : l'opcode puis ses opérandes.
+// Un registre est l'indice d'une case du cadre de la fonction, une
+// constante est stockée telle quelle dans le mot, une cible de saut est
+// la position d'une instruction dans le code.
+
+#define BC_BINOPS(X) \
+    X(ADD) X(SUB) X(MUL) X(DIV) X(MOD) X(SHL) X(SHR) X(AND) X(OR) \
+    X(EQ) X(NE) X(LT) X(LE) X(GT) X(GE)
+
+#define BC_CONDS(X) X(EQ) X(NE) X(LT) X(LE) X(GT) X(GE)
+
+enum BOp : int64_t {
+    // cadre de size registres, vérifie qu'il tient dans la pile
+    BC_ENTER,       // size
+    BC_MOV_R,       // dst, src
+    BC_MOV_I,       // dst, imm
+    BC_ARG,         // dst, n : dst = argument n
+    // dst = a op b, avec b registre (RR) ou constante (RI)
+#define X(op) BC_##op##_RR, BC_##op##_RI,
+    BC_BINOPS(X)
+#undef X
+    BC_LOAD_R,      // dst, addr
+    BC_LOAD_I,      // dst, addr constante
+    BC_STORE_R,     // addr, src
+    BC_STORE_I,     // addr constante, src
+    // accès de width octets, en little endian, width valant 2, 4 ou 8
+    BC_LOADW_R,     // dst, addr, width
+    BC_LOADW_I,     // dst, addr constante, width
+    BC_STOREW_R,    // addr, src, width
+    BC_STOREW_I,    // addr constante, src, width
+    // mots de 64 bits de la zone de mémoïsation, à une adresse en octets
+    BC_MLOAD,       // dst, addr
+    BC_MSTORE,      // addr, src
+    BC_PRINT,       // dst, addr, len
+    BC_READ,        // dst, addr, len
+    BC_FLUSH,       // dst
+    // intrinsèques, opérandes en registres comme pour IROp::MEMCPY à MEMCMP
+    BC_MEMCPY,      // dst, a, b, c
+    BC_MEMSET,      // dst, a, b, c
+    BC_MEMCHR,      // dst, a, b, c
+    BC_MEMCMP,      // dst, a, b, c
+    // caller_size est la taille du cadre de l'appelant, au-dessus duquel
+    // est construit celui de l'appelé ; chaque argument est une paire
+    // (0, registre) ou (1, constante)
+    BC_CALL,        // target, dst, caller_size, n, n paires
+    BC_TAILCALL,    // target, caller_size, n, n paires
+    BC_RET_R,       // src
+    BC_RET_I,       // imm
+    BC_JMP,         // target
+    // si a cond b aller à target sinon à target2
+#define X(cond) BC_BR_##cond##_RR, BC_BR_##cond##_RI,
+    BC_CONDS(X)
+#undef X
+    BC_OPS_NB
+};
+
+struct Bytecode{
+    vector<int64_t> code;
+    // position de l'instruction BC_ENTER de main
+    int64_t entry = 0;
+    // taille en octets de la zone de mémoïsation
+    int64_t memo_size = 0;
+    TapeConfig tape;
+};
+
+Bytecode compile_bytecode(const IRModule& module);
+// nombre de mots de l'instruction, opcode compris
+size_t instr_size(const int64_t* instr);
+
+// format de fichier : "TIPEBC4\0", entry, memo_size, taille du tape, options
+// du tape (1 pour populate, 2 pour huge_pages), nombre de mots puis les
+// mots, en little endian
+void write_bytecode(const char* path, const Bytecode& bc);
+Bytecode read_bytecode(const char* path);
+
+// exécute main et renvoie son résultat ; une division par zéro ou un
+// débordement de pile arrêtent le processus par le même signal que le
+// code natif. Les entrées-sorties sont tamponnées comme dans le code natif
+// si buffered_io.
+int64_t run_bytecode(const Bytecode& bc, bool buffered_io = true);
+
+#endif
@@ -1,255 +1,1028 @@
 #include "codegen.h"
-#include "ast.h"
+#include "regalloc.h"
 
-#include <fstream>
-#include <memory>
+#include <algorithm>
 #include <sstream>
-#include <cassert>
-#include <unordered_map>
-
-void AST::codegen(ofstream& out, Environement& env) {
-    out << "section .text\n\n"
-            "global _start\n\n";
-    for (auto& op : ops)
-        op->codegen(out, env);
-}
 
-void OpDef::codegen(ofstream& out, Environement& env) {
-    init_scope(out, env);
-    Signature sign = {op.lexeme, (int)lhs_args.size(), (int)rhs_args.size()};
-    auto [_, success] = env.op_ids.insert({sign, env.ops_nb++});
-    if (!success) {
-        stringstream error_msg;
-        error_msg << "operator \"" << op.lexeme << "\" is redefined here";
-        throw SemanticError(error_msg.str());
+// routines du runtime, émises une fois à la fin du programme quand il
+// s'en sert
+enum Routine{
+    RT_MEMCPY, RT_MEMSET, RT_MEMCHR, RT_MEMCMP, RT_PRINT, RT_READ, RT_FLUSH, ROUTINES_NB
+};
+
+static const char* const routine_names[ROUTINES_NB] = {
+    "tipe_memcpy", "tipe_memset", "tipe_memchr", "tipe_memcmp", "tipe_print", "tipe_read", "tipe_flush"
+};
+
+// routine qui exécute instr, -1 si l'instruction est traduite sur place
+static int routine(const Instr& instr, bool buffered_io) {
+    if (instr.is_intrinsic()) return RT_MEMCPY + (int)instr.op - (int)IROp::MEMCPY;
+    if (!buffered_io) return -1;
+    switch (instr.op) {
+        case IROp::PRINT: return RT_PRINT;
+        case IROp::READ: return RT_READ;
+        case IROp::FLUSH: return RT_FLUSH;
+        default: return -1;
     }
-    const static Signature main_sign = {":main", 0, 0};
-    if (sign == main_sign)
-        out << "_start:\n"
-            << "\tpush r15\n"
-            << "\tsub rsp, " << TAPE_SIZE << '\n'
-            << "\tmov r15, rsp\n";
-    else
-        out << "op" << env.ops_nb-1 << ":\n";
-    out << "\tpush rbp\n"
-        << "\tmov rbp, rsp\n";
-    env.curr_addr = -8;
-
-    int offset = (lhs_args.size() + rhs_args.size()-1)*8+16;
-    for (auto& arg : lhs_args) {
-        arg->offset = offset;
-        arg->define_in_scope(env);
-        arg->codegen(out, env);
-        offset -= 8;
+}
+
+// zone des tampons d'entrée-sortie, après celle de mémoïsation : longueur
+// du tampon de sortie, position et longueur du tampon d'entrée, puis les
+// deux tampons
+#define IO_OUT_LEN 0
+#define IO_IN_POS 8
+#define IO_IN_LEN 16
+#define IO_OUT_BUF 24
+#define IO_IN_BUF (IO_OUT_BUF + IO_BUFFER_SIZE)
+#define IO_REGION_SIZE (IO_IN_BUF + IO_BUFFER_SIZE)
+
+// Projection faite par main au lancement :
+//   [garde][tampons d'entrée-sortie][mémoïsation][garde][tape][garde]
+// Le tape occupe des pages entières entre deux pages de garde, pour qu'un
+// accès hors du tape, avant comme après, lève SIGSEGV ; r15 pointe sur son
+// début et les zones réservées, qui finissent sur la garde du milieu, sont
+// à des déplacements négatifs. Les pages ne sont allouées qu'au premier
+// accès, sauf avec TapeConfig::populate.
+struct TapeLayout{
+    TapeConfig tape;
+    // positions des zones réservées par rapport à r15
+    int32_t memo, io;
+    // tailles des zones réservées et du tape, multiples de TAPE_PAGE_SIZE
+    int64_t reserved, region;
+
+    TapeLayout(const TapeConfig& tape, int64_t memo_size, int64_t io_size)
+        : tape(tape), memo(-TAPE_PAGE_SIZE - memo_size), io(memo - io_size) {
+        reserved = round_up(memo_size + io_size);
+        region = round_up(tape.size);
     }
-    for (auto& arg : rhs_args) {
-        arg->offset = offset;
-        arg->define_in_scope(env);
-        arg->codegen(out, env);
-        offset -= 8;
+    static int64_t round_up(int64_t size) {
+        return (size + TAPE_PAGE_SIZE - 1) / TAPE_PAGE_SIZE * TAPE_PAGE_SIZE;
     }
+    // position de r15 par rapport au début de la projection
+    int64_t tape_offset() const { return reserved + 2*TAPE_PAGE_SIZE; }
+    int64_t mapping_size() const { return tape_offset() + region + TAPE_PAGE_SIZE; }
+};
 
-    for (auto& statement : statements)
-        statement->codegen(out, env);
+// registre de destination d'un mov de val, sur 32 bits quand il suffit
+// puisqu'il met à zéro la moitié haute
+static Operand imm_dest(Reg r, int64_t val) {
+    return reg(r, val >= 0 && val <= 0xFFFFFFFF ? 4 : 8);
+}
 
-    del_scope(out, env);
+// traduction d'une fonction, rax, rcx, rdx et r11 servant de registres de
+// travail
+class FunctionCodegen{
+    private :
+        const IRFunction& m_func;
+        const Allocation m_alloc;
+        MProgram& m_prog;
+        const vector<int>& m_func_labels;
+        // label de chaque routine du runtime, -1 si elle n'est pas émise
+        const vector<int>& m_routine_labels;
+        // main retourne à son appelant au lieu de terminer le processus
+        const bool m_returns;
+        const TapeLayout& m_layout;
+        // rbp n'est utilisé que pour les emplacements de pile : arguments
+        // empilés et débordements. Sans eux, la fonction n'a pas de cadre.
+        const bool m_frame;
+        vector<int> m_block_labels;
+        int m_epilogue, m_map_failed, m_protect_failed;
 
-    out << "\tpop rbp\n";
-    if (sign == main_sign)
-        out << "\tadd rsp, " << TAPE_SIZE << '\n'
-            << "\tpop r15\n"
-            << "\tmov rdi, rax\n"
-            << "\tmov rax, 60\n"
-            << "\tsyscall\n\n";
-    else
-        out << "\tret\n\n";
-}
+        Operand loc(Value val) const {
+            if (val.is_imm()) return imm(val.val);
+            const Location& l = m_alloc.locs[val.val];
+            if (l.kind == Location::REG) return reg(l.reg);
+            return mem(RBP, l.offset);
+        }
 
-void Scope::init_scope(ofstream& out, Environement& env) {
-    env.curr_scope = this;
-}
+        void mov(Operand dst, Operand src) {
+            if (dst == src) return;
+            if (src.kind == Operand::IMM) {
+                if (dst.kind == Operand::REG && src.val == 0) {
+                    m_prog.emit(MOp::XOR, reg(dst.base, 4), reg(dst.base, 4));
+                    return;
+                }
+                if (dst.kind == Operand::MEM && !fits_imm32(src.val)) {
+                    m_prog.emit(MOp::MOV, reg(RAX), src);
+                    src = reg(RAX);
+                }
+            } else if (dst.kind == Operand::MEM && src.kind == Operand::MEM) {
+                m_prog.emit(MOp::MOV, reg(RAX), src);
+                src = reg(RAX);
+            }
+            m_prog.emit(MOp::MOV, dst, src);
+        }
 
-void Scope::del_scope(ofstream& out, Environement& env) {
-    out << "\tadd rsp, " << bytes_owned << "\n";
-    for (int i = 0; i < int_def_nb; i++) {
-        auto it = env.adress_table.find(env.stack_frame.back());
-        assert(it != env.adress_table.end());
-        env.adress_table.erase(it);
-        env.stack_frame.pop_back();
-    }
-}
+        // opérande d'adresse tape[addr], en passant par rax si besoin ; la
+        // zone de mémoïsation commence à l'octet m_layout.memo
+        Operand tape(Value addr, int size, int32_t disp = 0) {
+            Operand a = loc(addr);
+            if (a.kind == Operand::IMM && fits_imm32(a.val + disp))
+                return mem(R15, a.val + disp, size);
+            if (a.kind != Operand::REG) {
+                mov(reg(RAX), a);
+                a = reg(RAX);
+            }
+            return mem(R15, a.base, disp, size);
+        }
 
-void Var::define_in_scope(Environement& env) {
-    auto [_, success] = env.adress_table.insert({id.lexeme, offset});
-    if (!success) {
-        stringstream err;
-        err << "identifier \"" << id.lexeme << "\" is redefined here";
-        throw SemanticError(err.str());
-    }
-    env.stack_frame.push_back(id.lexeme);
-    env.curr_scope->int_def_nb++;
-}
+        void binop(const Instr& instr) {
+            Operand d = loc(instr.dst), a = loc(instr.a), b = loc(instr.b);
+            bool commutative = instr.op == IROp::ADD || instr.op == IROp::MUL
+                || instr.op == IROp::AND || instr.op == IROp::OR;
+            if (commutative && (b == d || a.kind == Operand::IMM) && a != d) swap(a, b);
+            Operand t = d.kind == Operand::REG && d != b ? d : reg(RAX);
+            mov(t, a);
+            if (b.kind == Operand::IMM && !fits_imm32(b.val)) {
+                mov(reg(R11), b);
+                b = reg(R11);
+            }
+            MOp op;
+            switch (instr.op) {
+                case IROp::ADD: op = MOp::ADD; break;
+                case IROp::SUB: op = MOp::SUB; break;
+                case IROp::AND: op = MOp::AND; break;
+                case IROp::OR: op = MOp::OR; break;
+                case IROp::SHL: op = MOp::SHL; break;
+                case IROp::SHR: op = MOp::SHR; break;
+                default: op = MOp::IMUL; break;
+            }
+            m_prog.emit(op, t, b);
+            mov(d, t);
+        }
 
-void Var::codegen(ofstream&, Environement& env) {
-    return;
-}
+        // positionne les drapeaux pour "a cond b" ; cond est retourné si les
+        // opérandes doivent être échangés (cmp n'accepte pas d'immédiat à gauche)
+        IROp compare(Value va, Value vb, IROp cond) {
+            Operand a = loc(va), b = loc(vb);
+            if (a.kind == Operand::IMM && b.kind != Operand::IMM) {
+                swap(a, b);
+                cond = swap_comparison(cond);
+            }
+            if (a.kind == Operand::IMM || (a.kind == Operand::MEM && b.kind == Operand::MEM)) {
+                mov(reg(RAX), a);
+                a = reg(RAX);
+            }
+            if (b.kind == Operand::IMM && !fits_imm32(b.val)) {
+                mov(reg(R11), b);
+                b = reg(R11);
+            }
+            if (a.kind == Operand::REG && b == imm(0) && (cond == IROp::EQ || cond == IROp::NE))
+                m_prog.emit(MOp::TEST, a, a);
+            else
+                m_prog.emit(MOp::CMP, a, b);
+            return cond;
+        }
 
-void Define::codegen(ofstream& out, Environement& env) {
-    lval->offset = env.curr_addr;
-    lval->define_in_scope(env);
-    lval->codegen(out, env);
-    expr->codegen(out, env);
-    out << "\tpush rax\n";
-    env.curr_scope->bytes_owned += 8;
-    env.curr_addr -= 8;
-}
+        static MOp jcc(IROp cond) {
+            switch (cond) {
+                case IROp::EQ: return MOp::JE;
+                case IROp::NE: return MOp::JNE;
+                case IROp::LT: return MOp::JL;
+                case IROp::LE: return MOp::JLE;
+                case IROp::GT: return MOp::JG;
+                default: return MOp::JGE;
+            }
+        }
 
-void RvalToken::codegen(ofstream& out, Environement& env) {
-    if (id.type == NUM)
-        out << "\tmov rax, " << atoll(id.lexeme) << '\n';
-    else {
-        auto it = env.adress_table.find(id.lexeme);
-        if (it == env.adress_table.end()) {
-            stringstream err;
-            err << "identifier \"" << id.lexeme << "\" is used without being defined here";
-            throw SemanticError(err.str());
-        }
-        out << "\tmov rax, QWORD [rbp+" << it->second << "]\n";
-    }
-}
+        static MOp setcc(IROp cond) {
+            switch (cond) {
+                case IROp::EQ: return MOp::SETE;
+                case IROp::NE: return MOp::SETNE;
+                case IROp::LT: return MOp::SETL;
+                case IROp::LE: return MOp::SETLE;
+                case IROp::GT: return MOp::SETG;
+                default: return MOp::SETGE;
+            }
+        }
 
-void RvalAccess::codegen(ofstream& out, Environement& env) {
-    index->codegen(out, env);
-    out << "\tadd rax, r15\n"
-        << "\tmov rsi, rax\n"
-        << "\txor rax, rax\n" // clear rax bcz of int promotion
-        << "\tmov al, BYTE [rsi]\n";
-}
+        void comparison(const Instr& instr) {
+            IROp cond = compare(instr.a, instr.b, instr.op);
+            Operand d = loc(instr.dst);
+            Reg t = d.kind == Operand::REG ? d.base : RAX;
+            m_prog.emit(setcc(cond), reg(t, 1));
+            m_prog.emit(MOp::MOVZX, reg(t, 4), reg(t, 1));
+            mov(d, reg(t));
+        }
 
-unordered_map<string, string> prelude_binops;
-
-void OpApply::codegen(ofstream& out, Environement& env) {
-    Signature sign = {op.lexeme, (int)lhs.size(), (int)rhs.size()};
-    prelude_binops.insert({string("+"), "add"});
-    prelude_binops.insert({string("-"), "sub"});
-    prelude_binops.insert({string("*"), "imul"});
-    prelude_binops.insert({string("/"), "idiv"});
-    auto it1 = prelude_binops.find(op.lexeme);
-    if (sign.left_arity == 1 && sign.right_arity == 1 && it1 != prelude_binops.end()) {
-        rhs[0]->codegen(out, env);
-        out << "\tpush rax\n";
-        lhs[0]->codegen(out, env);
-        out << "\tpop rsi\n";
-        if (op.lexeme == string("/"))
-            out << "\txor rdx, rdx\n"
-                << "\tidiv rsi\n";
-        else
-            out << "\t" << it1->second << " rax, rsi\n";
-        return;
-    }
-    for (auto& l_arg : lhs) {
-        l_arg->codegen(out, env);
-        out << "\tpush rax\n";
-    }
-    for (auto& r_arg : rhs) {
-        r_arg->codegen(out, env);
-        out << "\tpush rax\n";
-    }
-    if ((op.lexeme == string(":print") || op.lexeme == string(":read"))
-            && sign.left_arity == 0 && sign.right_arity == 2) {
-        out << "\tmov rax, " << (op.lexeme == string(":print")) << "\n"
-            << "\tmov rdi, 1\n"
-            << "\tpop rdx\n"
-            << "\tpop rsi\n"
-            << "\tadd rsi, r15\n"
-            << "\tsyscall\n";
-        return;
-    }
-    auto it = env.op_ids.find(sign);
-    if (it == env.op_ids.end()) {
-        stringstream err;
-        err << "operator \"" << op.lexeme << "\" with these arguments is used without being defined here";
-        throw SemanticError(err.str());
-    }
-    out << "\tcall op" << it->second << '\n';
-    out << "\tadd rsp, " << (lhs.size()+rhs.size())*8 << '\n';
-}
+        // quotient non signé de n par la constante d >= 2, dans rdx ou rcx :
+        // multiplication par l'inverse de d en virgule fixe (Granlund et
+        // Montgomery), n étant dans un registre ou en mémoire
+        Reg div_by_constant(Operand n, uint64_t d) {
+            if (!(d & (d-1))) {
+                mov(reg(RDX), n);
+                m_prog.emit(MOp::SHR, reg(RDX), imm(__builtin_ctzll(d)));
+                return RDX;
+            }
+            typedef unsigned __int128 u128;
+            // l = ceil(log2(d))
+            int l = 64 - __builtin_clzll(d-1);
+            // q = (n * m) >> (64 + s) avec m = ceil(2^(64+s) / d) sur 64 bits
+            // est exact pour tout n < 2^64 dès que m*d - 2^(64+s) <= 2^s
+            for (int s = 0; s <= l; s++) {
+                u128 m = ((u128)1 << (64+s)) / d + 1;
+                if (m >> 64 || m*d - ((u128)1 << (64+s)) > ((u128)1 << s)) continue;
+                mov(reg(RAX), imm((int64_t)m));
+                m_prog.emit(MOp::MUL, n);
+                if (s) m_prog.emit(MOp::SHR, reg(RDX), imm(s));
+                return RDX;
+            }
+            // sinon le multiplicateur a 65 bits : t = (n * m') >> 64 puis
+            // q = (t + ((n - t) >> 1)) >> (l - 1)
+            u128 m = ((u128)1 << 64) * (((u128)1 << l) - d) / d + 1;
+            mov(reg(RAX), imm((int64_t)m));
+            m_prog.emit(MOp::MUL, n);
+            mov(reg(RCX), n);
+            m_prog.emit(MOp::SUB, reg(RCX), reg(RDX));
+            m_prog.emit(MOp::SHR, reg(RCX), imm(1));
+            m_prog.emit(MOp::ADD, reg(RCX), reg(RDX));
+            m_prog.emit(MOp::SHR, reg(RCX), imm(l-1));
+            return RCX;
+        }
 
-void Return::codegen(ofstream& out, Environement& env) {
-    expr->codegen(out, env);
-}
+        void div(const Instr& instr) {
+            Operand b = loc(instr.b);
+            // par une constante autre que 0, 1 et -1, le quotient de n
+            // par b est celui de n par |b|, au signe près
+            if (b.kind == Operand::IMM && (uint64_t)b.val + 1 > 2) {
+                Operand n = loc(instr.a);
+                if (n.kind == Operand::IMM) {
+                    mov(reg(R11), n);
+                    n = reg(R11);
+                }
+                uint64_t d = b.val < 0 ? -(uint64_t)b.val : b.val;
+                Operand q = reg(div_by_constant(n, d));
+                if (instr.op == IROp::DIV) {
+                    if (b.val < 0) m_prog.emit(MOp::NEG, q);
+                    mov(loc(instr.dst), q);
+                    return;
+                }
+                // n - q*d
+                if (fits_imm32(d))
+                    m_prog.emit(MOp::IMUL, q, imm(d));
+                else {
+                    mov(reg(RAX), imm(d));
+                    m_prog.emit(MOp::IMUL, q, reg(RAX));
+                }
+                mov(reg(RAX), n);
+                m_prog.emit(MOp::SUB, reg(RAX), q);
+                mov(loc(instr.dst), reg(RAX));
+                return;
+            }
+            mov(reg(RAX), loc(instr.a));
+            // le dividende est rdx:rax avec rdx = 0, comme l'a toujours fait le langage
+            m_prog.emit(MOp::XOR, reg(RDX, 4), reg(RDX, 4));
+            if (b.kind == Operand::IMM) {
+                mov(reg(R11), b);
+                b = reg(R11);
+            }
+            m_prog.emit(MOp::IDIV, b);
+            mov(loc(instr.dst), reg(instr.op == IROp::DIV ? RAX : RDX));
+        }
 
-int IfStatement::branch_count = 0;
-
-void IfStatement::codegen(ofstream& out, Environement& env) {
-    cond->codegen(out, env);
-    int branchfalse = branch_count;
-    out << "\tcmp rax, 0\n"
-        << "\tje branch" << branch_count++ << '\n';
-    expr_true->codegen(out, env);
-    int branchtrue = branch_count;
-    out << "\tjmp branch" << branch_count++ << '\n';
-    out << "branch" << branchfalse << ":\n";
-    expr_false->codegen(out, env);
-    out << "branch" << branchtrue << ":\n";
-}
+        void push(Value val) {
+            Operand a = loc(val);
+            if (a.kind == Operand::IMM && !fits_imm32(a.val)) {
+                mov(reg(RAX), a);
+                a = reg(RAX);
+            }
+            m_prog.emit(MOp::PUSH, a);
+        }
 
-void LvalAccess::codegen(ofstream& out, Environement& env) {
-    index->codegen(out, env);
-    out << "\tadd rax, r15\n";
-}
+        // copies simultanées vers des destinations distinctes : chacune
+        // n'est écrite qu'une fois lue par les autres copies, et rax sert à
+        // briser les cycles
+        void parallel_move(vector<pair<Operand, Operand>> moves) {
+            moves.erase(remove_if(moves.begin(), moves.end(),
+                [](const pair<Operand, Operand>& m) { return m.first == m.second; }), moves.end());
+            auto is_read = [&](const Operand& dst) {
+                return dst.kind == Operand::REG && any_of(moves.begin(), moves.end(),
+                    [&](const pair<Operand, Operand>& m) { return m.second == dst; });
+            };
+            while (!moves.empty()) {
+                auto ready = find_if(moves.begin(), moves.end(),
+                    [&](const pair<Operand, Operand>& m) { return !is_read(m.first); });
+                if (ready != moves.end()) {
+                    mov(ready->first, ready->second);
+                    moves.erase(ready);
+                    continue;
+                }
+                Operand src = moves[0].second;
+                mov(reg(RAX), src);
+                for (auto& m : moves)
+                    if (m.second == src) m.second = reg(RAX);
+            }
+        }
 
-string Var::get_name(Environement& env) {
-    auto it = env.adress_table.find(id.lexeme);
-    if (it == env.adress_table.end()) {
-        stringstream err;
-        err << "identifier \"" << id.lexeme << "\" is used without being defined here";
-        throw SemanticError(err.str());
-    }
-    stringstream res;
-    res << "QWORD [rbp+" << it->second << "]";
-    return res.str();
-}
+        // registres des arguments de instr, à charger une fois les autres empilés
+        vector<pair<Operand, Operand>> arg_moves(const Instr& instr) {
+            vector<pair<Operand, Operand>> moves;
+            for (int i = 0; i < (int)instr.args.size() && i < REG_ARGS_NB; i++)
+                moves.push_back({reg(arg_regs[i]), loc(instr.args[i])});
+            return moves;
+        }
 
-string LvalAccess::get_name(Environement& env) {
-    return "BYTE [rax]";
-}
+        void call(const Instr& instr) {
+            int stacked = max(0, (int)instr.args.size() - REG_ARGS_NB);
+            for (int i = REG_ARGS_NB; i < (int)instr.args.size(); i++)
+                push(instr.args[i]);
+            parallel_move(arg_moves(instr));
+            m_prog.emit(MOp::CALL, label(m_func_labels[instr.callee]));
+            if (stacked)
+                m_prog.emit(MOp::ADD, reg(RSP), imm(8*stacked));
+            mov(loc(instr.dst), reg(RAX));
+        }
 
-int Var::size() { return 8; }
-int LvalAccess::size() { return 1; }
-
-void Assign::codegen(ofstream& out, Environement& env) {
-    string size_to_str[9];
-    size_to_str[8] = "";
-    size_to_str[4] = "D"; // dword
-    size_to_str[2] = "W"; // word
-    size_to_str[1] = "B"; // byte
-    expr->codegen(out, env);
-    out << "\tpush rax\n";
-    lval->codegen(out, env);
-    out << "\tpop r8\n";
-    out << "\tmov "<< lval->get_name(env) << ", r8" << size_to_str[lval->size()] << "\n";
-}
+        void syscall(const Instr& instr) {
+            // rsi et rdi peuvent contenir les opérandes : on les lit d'abord
+            mov(reg(RDX), loc(instr.b));
+            mov(reg(RAX), loc(instr.a));
+            m_prog.emit(MOp::LEA, reg(RSI), mem(R15, RAX, 0, 8));
+            // write(1, ...) ou read(0, ...)
+            m_prog.emit(MOp::MOV, reg(RDI, 4), imm(instr.op == IROp::PRINT));
+            m_prog.emit(MOp::MOV, reg(RAX, 4), imm(instr.op == IROp::PRINT));
+            m_prog.emit(MOp::SYSCALL);
+            mov(loc(instr.dst), reg(RAX));
+        }
 
-void FuncCall::codegen(ofstream& out, Environement& env) {
-    expr->codegen(out, env);
-}
+        // les routines reçoivent leurs opérandes dans rdi, rsi et rdx, qui
+        // peuvent contenir les opérandes : ils passent d'abord par rax et rcx
+        void call_routine(int routine, const Instr& instr) {
+            vector<Value> ops = instr.args;
+            for (Value val : {instr.a, instr.b})
+                if (val.kind != Value::NONE) ops.push_back(val);
+            static const Reg scratch[] = {RAX, RCX, RDX};
+            for (size_t i = 0; i < ops.size(); i++)
+                mov(reg(scratch[i]), loc(ops[i]));
+            if (ops.size() > 0) mov(reg(RDI), reg(RAX));
+            if (ops.size() > 1) mov(reg(RSI), reg(RCX));
+            m_prog.emit(MOp::CALL, label(m_routine_labels[routine]));
+            mov(loc(instr.dst), reg(RAX));
+        }
 
-template <class T>
-inline void hash_combine(std::size_t & s, const T & v)
-{
-  std::hash<T> h;
-  s^= h(v) + 0x9e3779b9 + (s<< 6) + (s>> 2);
-}
+        void branch(const Instr& instr, int next_block) {
+            int64_t taken;
+            if (instr.a.is_imm() && instr.b.is_imm() && eval_binop(instr.cond, instr.a.val, instr.b.val, taken)) {
+                int target = taken ? instr.target : instr.target2;
+                if (target != next_block)
+                    m_prog.emit(MOp::JMP, label(m_block_labels[target]));
+                return;
+            }
+            IROp cond = compare(instr.a, instr.b, instr.cond);
+            if (instr.target2 == next_block) {
+                m_prog.emit(jcc(cond), label(m_block_labels[instr.target]));
+                return;
+            }
+            m_prog.emit(jcc(negate_comparison(cond)), label(m_block_labels[instr.target2]));
+            if (instr.target != next_block)
+                m_prog.emit(MOp::JMP, label(m_block_labels[instr.target]));
+        }
 
-size_t std::hash<Signature>::operator()(const Signature& sign) const {
-    size_t res = 0;
-    hash_combine(res, sign.name);
-    hash_combine(res, sign.left_arity);
-    hash_combine(res, sign.right_arity);
-    return res;
-}
+        void prologue() {
+            m_prog.emit(MOp::LABEL, label(m_func_labels[m_func.id]));
+            if (m_func.is_main) {
+                // r15 est préservé par les appels de la convention C. run_jit
+                // fournit dans rdi une pile neuve, à zéro comme celle d'un
+                // processus : rsp y est sauvegardé, puis l'adresse reçue dans
+                // rsi où écrire l'erreur si le tape ne peut être projeté
+                if (m_returns) {
+                    m_prog.emit(MOp::PUSH, reg(R15));
+                    m_prog.emit(MOp::MOV, reg(RAX), reg(RSP));
+                    m_prog.emit(MOp::MOV, reg(RSP), reg(RDI));
+                    m_prog.emit(MOp::PUSH, reg(RAX));
+                    m_prog.emit(MOp::PUSH, reg(RSI));
+                }
+                map_tape();
+                if (m_returns) m_prog.emit(MOp::ADD, reg(RSP), imm(8));
+            }
+            if (m_frame) {
+                m_prog.emit(MOp::PUSH, reg(RBP));
+                m_prog.emit(MOp::MOV, reg(RBP), reg(RSP));
+            }
+            for (Reg r : m_alloc.saved_regs)
+                m_prog.emit(MOp::PUSH, reg(r));
+            if (m_alloc.spill_slots)
+                m_prog.emit(MOp::SUB, reg(RSP), imm(8*m_alloc.spill_slots));
+            // les arguments reçus en registres rejoignent leur emplacement,
+            // avant que les registres de travail ne servent
+            vector<pair<Operand, Operand>> moves;
+            for (const BasicBlock& block : m_func.blocks)
+                for (const Instr& instr : block.instrs)
+                    if (instr.op == IROp::ARG && instr.a.val < REG_ARGS_NB)
+                        moves.push_back({loc(instr.dst), reg(arg_regs[instr.a.val])});
+            parallel_move(moves);
+        }
+
+        void epilogue() {
+            m_prog.emit(MOp::LABEL, label(m_epilogue));
+            if (m_func.is_main && m_routine_labels[RT_FLUSH] != -1) {
+                m_prog.emit(MOp::PUSH, reg(RAX));
+                m_prog.emit(MOp::CALL, label(m_routine_labels[RT_FLUSH]));
+                m_prog.emit(MOp::POP, reg(RAX));
+            }
+            if (m_func.is_main && m_returns) {
+                restore_frame(true);
+                // munmap(début de la projection, taille)
+                m_prog.emit(MOp::PUSH, reg(RAX));
+                m_prog.emit(MOp::LEA, reg(RDI), mem(R15, -m_layout.tape_offset()));
+                m_prog.emit(MOp::MOV, imm_dest(RSI, m_layout.mapping_size()), imm(m_layout.mapping_size()));
+                m_prog.emit(MOp::MOV, reg(RAX, 4), imm(11));
+                m_prog.emit(MOp::SYSCALL);
+                m_prog.emit(MOp::POP, reg(RAX));
+                m_prog.emit(MOp::POP, reg(RSP));
+                m_prog.emit(MOp::POP, reg(R15));
+                m_prog.emit(MOp::RET);
+            } else if (m_func.is_main) {
+                m_prog.emit(MOp::MOV, reg(RDI), reg(RAX));
+                m_prog.emit(MOp::MOV, reg(RAX, 4), imm(60));
+                m_prog.emit(MOp::SYSCALL);
+            }
+            if (m_func.is_main) {
+                map_failed();
+                return;
+            }
+            restore_frame(m_alloc.spill_slots > 0);
+            m_prog.emit(MOp::RET);
+        }
+
+        // projette le tape et les zones réservées, r15 pointant sur le tape.
+        // Les registres des arguments sont libres : main n'en a pas.
+        void map_tape() {
+            int64_t size = m_layout.mapping_size();
+            // mmap(0, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)
+            m_prog.emit(MOp::XOR, reg(RDI, 4), reg(RDI, 4));
+            m_prog.emit(MOp::MOV, imm_dest(RSI, size), imm(size));
+            m_prog.emit(MOp::XOR, reg(RDX, 4), reg(RDX, 4));
+            m_prog.emit(MOp::MOV, reg(R10, 4), imm(0x4022));
+            m_prog.emit(MOp::MOV, reg(R8), imm(-1));
+            m_prog.emit(MOp::XOR, reg(R9, 4), reg(R9, 4));
+            m_prog.emit(MOp::MOV, reg(RAX, 4), imm(9));
+            m_prog.emit(MOp::SYSCALL);
+            m_prog.emit(MOp::TEST, reg(RAX), reg(RAX));
+            m_prog.emit(MOp::JL, label(m_map_failed));
+            m_prog.emit(MOp::LEA, reg(R15), mem(RAX, m_layout.tape_offset()));
+            // mprotect(zone, taille, PROT_READ | PROT_WRITE) sur les zones
+            // réservées puis sur le tape : les pages de garde restent PROT_NONE
+            if (m_layout.reserved) {
+                m_prog.emit(MOp::LEA, reg(RDI), mem(RAX, TAPE_PAGE_SIZE));
+                m_prog.emit(MOp::MOV, imm_dest(RSI, m_layout.reserved), imm(m_layout.reserved));
+                protect();
+            }
+            m_prog.emit(MOp::MOV, reg(RDI), reg(R15));
+            m_prog.emit(MOp::MOV, imm_dest(RSI, m_layout.region), imm(m_layout.region));
+            protect();
+            // madvise(rdi, rsi, MADV_HUGEPAGE puis MADV_POPULATE_WRITE), dont
+            // un échec ne fait que perdre l'optimisation
+            for (auto [wanted, advice] : {pair{m_layout.tape.huge_pages, 14}, pair{m_layout.tape.populate, 23}}) {
+                if (!wanted) continue;
+                m_prog.emit(MOp::MOV, reg(RDX, 4), imm(advice));
+                m_prog.emit(MOp::MOV, reg(RAX, 4), imm(28));
+                m_prog.emit(MOp::SYSCALL);
+            }
+        }
+
+        void protect() {
+            m_prog.emit(MOp::MOV, reg(RDX, 4), imm(3));
+            m_prog.emit(MOp::MOV, reg(RAX, 4), imm(10));
+            m_prog.emit(MOp::SYSCALL);
+            m_prog.emit(MOp::TEST, reg(RAX), reg(RAX));
+            m_prog.emit(MOp::JL, label(m_protect_failed));
+        }
+
+        // échec de map_tape, -errno dans rax. run_jit reçoit l'erreur à
+        // l'adresse qu'il a passée ; un exécutable l'annonce sur la sortie
+        // d'erreur et s'arrête avec le statut 1
+        void map_failed() {
+            // munmap(début de la projection, taille), rdx étant préservé
+            m_prog.emit(MOp::LABEL, label(m_protect_failed));
+            m_prog.emit(MOp::MOV, reg(RDX), reg(RAX));
+            m_prog.emit(MOp::LEA, reg(RDI), mem(R15, -m_layout.tape_offset()));
+            m_prog.emit(MOp::MOV, imm_dest(RSI, m_layout.mapping_size()), imm(m_layout.mapping_size()));
+            m_prog.emit(MOp::MOV, reg(RAX, 4), imm(11));
+            m_prog.emit(MOp::SYSCALL);
+            m_prog.emit(MOp::MOV, reg(RAX), reg(RDX));
+            m_prog.emit(MOp::LABEL, label(m_map_failed));
+            if (m_returns) {
+                m_prog.emit(MOp::POP, reg(RSI));
+                m_prog.emit(MOp::MOV, mem(RSI, 0), reg(RAX));
+                m_prog.emit(MOp::POP, reg(RSP));
+                m_prog.emit(MOp::POP, reg(R15));
+                m_prog.emit(MOp::RET);
+                return;
+            }
+            // write(2, message, longueur) avec le message construit sur la pile
+            static const char message[] = "cannot map the tape\n";
+            int len = sizeof(message) - 1;
+            for (int i = (len - 1) / 8 * 8; i >= 0; i -= 8) {
+                uint64_t word = 0;
+                for (int j = 0; j < 8 && i + j < len; j++)
+                    word |= (uint64_t)(uint8_t)message[i + j] << 8*j;
+                m_prog.emit(MOp::MOV, reg(RAX), imm(word));
+                m_prog.emit(MOp::PUSH, reg(RAX));
+            }
+            m_prog.emit(MOp::MOV, reg(RDI, 4), imm(2));
+            m_prog.emit(MOp::MOV, reg(RSI), reg(RSP));
+            m_prog.emit(MOp::MOV, reg(RDX, 4), imm(len));
+            m_prog.emit(MOp::MOV, reg(RAX, 4), imm(1));
+            m_prog.emit(MOp::SYSCALL);
+            m_prog.emit(MOp::MOV, reg(RDI, 4), imm(1));
+            m_prog.emit(MOp::MOV, reg(RAX, 4), imm(60));
+            m_prog.emit(MOp::SYSCALL);
+        }
+
+        // défait le prologue : rsp pointe ensuite sur l'adresse de retour
+        void restore_frame(bool reset_rsp) {
+            if (reset_rsp)
+                m_prog.emit(MOp::LEA, reg(RSP), mem(RBP, -8*(int)m_alloc.saved_regs.size()));
+            for (auto it = m_alloc.saved_regs.rbegin(); it != m_alloc.saved_regs.rend(); ++it)
+                m_prog.emit(MOp::POP, reg(*it));
+            if (m_frame) m_prog.emit(MOp::POP, reg(RBP));
+        }
+
+        // les arguments de l'appelé remplacent ceux de la fonction courante,
+        // puis on saute à l'appelé qui retournera directement à notre appelant.
+        // Les arguments empilés vont dans la zone des nôtres, qui existe
+        // puisque TailCallElimination vérifie qu'elle est assez grande.
+        void tail_call(const Instr& instr) {
+            int n = instr.args.size();
+            auto arg_slot = [&](int i) { return mem(RBP, 16 + 8*(n-1-i)); };
+            // si un argument est lu dans la zone des arguments reçus, l'écrire
+            // directement pourrait écraser une valeur pas encore lue
+            bool overlap = false;
+            if (n > REG_ARGS_NB)
+                for (const Value& arg : instr.args) {
+                    Operand a = loc(arg);
+                    if (a.kind == Operand::MEM && a.val >= 16) overlap = true;
+                }
+            if (!overlap) {
+                for (int i = REG_ARGS_NB; i < n; i++)
+                    mov(arg_slot(i), loc(instr.args[i]));
+                parallel_move(arg_moves(instr));
+            } else {
+                for (const Value& arg : instr.args)
+                    push(arg);
+                for (int i = 0; i < n; i++) {
+                    Operand copy = mem(RSP, 8*(n-1-i));
+                    if (i < REG_ARGS_NB) mov(reg(arg_regs[i]), copy);
+                    else mov(arg_slot(i), copy);
+                }
+            }
+            restore_frame(overlap || m_alloc.spill_slots > 0);
+            m_prog.emit(MOp::JMP, label(m_func_labels[instr.callee]));
+        }
+
+        void instr(const Instr& instr, int next_block) {
+            switch (instr.op) {
+                case IROp::COPY:
+                    mov(loc(instr.dst), loc(instr.a));
+                    break;
+                case IROp::ADD: case IROp::SUB: case IROp::MUL: case IROp::AND: case IROp::OR:
+                case IROp::SHL: case IROp::SHR:
+                    binop(instr);
+                    break;
+                case IROp::EQ: case IROp::NE: case IROp::LT: case IROp::LE: case IROp::GT: case IROp::GE:
+                    comparison(instr);
+                    break;
+                case IROp::DIV: case IROp::MOD:
+                    div(instr);
+                    break;
+                case IROp::ARG:
+                    // les arguments reçus en registres sont recopiés par le prologue
+                    if (instr.a.val >= REG_ARGS_NB)
+                        mov(loc(instr.dst), mem(RBP, 16 + 8*(m_func.args_nb-1-instr.a.val)));
+                    break;
+                case IROp::LOAD: {
+                    Operand d = loc(instr.dst);
+                    Reg t = d.kind == Operand::REG ? d.base : RAX;
+                    // un mov 32 bits met à zéro la moitié haute du registre
+                    if (instr.width <= 2) m_prog.emit(MOp::MOVZX, reg(t, 4), tape(instr.a, instr.width));
+                    else m_prog.emit(MOp::MOV, reg(t, instr.width), tape(instr.a, instr.width));
+                    mov(d, reg(t));
+                    break;
+                }
+                case IROp::STORE: {
+                    Operand val = loc(instr.b);
+                    int width = instr.width;
+                    // seuls les width octets de poids faible sont écrits
+                    if (val.kind == Operand::IMM && width == 4) val.val = (int32_t)val.val;
+                    else if (val.kind == Operand::IMM && width < 4) val.val &= ((int64_t)1 << 8*width) - 1;
+                    if ((val.kind == Operand::IMM && !fits_imm32(val.val)) || val.kind == Operand::MEM) {
+                        mov(reg(R11), val);
+                        val = reg(R11);
+                    }
+                    if (val.kind == Operand::REG) val.size = width;
+                    m_prog.emit(MOp::MOV, tape(instr.a, width), val);
+                    break;
+                }
+                case IROp::MLOAD: {
+                    Operand d = loc(instr.dst);
+                    Reg t = d.kind == Operand::REG ? d.base : RAX;
+                    m_prog.emit(MOp::MOV, reg(t), tape(instr.a, 8, m_layout.memo));
+                    mov(d, reg(t));
+                    break;
+                }
+                case IROp::MSTORE: {
+                    Operand val = loc(instr.b);
+                    if (val.kind == Operand::MEM || (val.kind == Operand::IMM && !fits_imm32(val.val))) {
+                        mov(reg(R11), val);
+                        val = reg(R11);
+                    }
+                    m_prog.emit(MOp::MOV, tape(instr.a, 8, m_layout.memo), val);
+                    break;
+                }
+                case IROp::CALL:
+                    call(instr);
+                    break;
+                case IROp::TAILCALL:
+                    tail_call(instr);
+                    break;
+                case IROp::PRINT: case IROp::READ:
+                case IROp::MEMCPY: case IROp::MEMSET: case IROp::MEMCHR: case IROp::MEMCMP: {
+                    int r = routine(instr, m_routine_labels[RT_FLUSH] != -1);
+                    if (r == -1) syscall(instr);
+                    else call_routine(r, instr);
+                    break;
+                }
+                case IROp::FLUSH:
+                    // sans tampon, il n'y a rien à vider
+                    if (m_routine_labels[RT_FLUSH] == -1) mov(loc(instr.dst), imm(0));
+                    else call_routine(RT_FLUSH, instr);
+                    break;
+                case IROp::RET:
+                    mov(reg(RAX), loc(instr.a));
+                    if (next_block != -1)
+                        m_prog.emit(MOp::JMP, label(m_epilogue));
+                    break;
+                case IROp::BR:
+                    branch(instr, next_block);
+                    break;
+                case IROp::JMP:
+                    if (instr.target != next_block)
+                        m_prog.emit(MOp::JMP, label(m_block_labels[instr.target]));
+                    break;
+            }
+        }
+
+    public :
+        FunctionCodegen(const IRFunction& func, MProgram& prog, const vector<int>& func_labels,
+                        const vector<int>& routine_labels, bool returns, const TapeLayout& layout)
+            : m_func(func), m_alloc(allocate_registers(func)), m_prog(prog), m_func_labels(func_labels),
+              m_routine_labels(routine_labels), m_returns(returns), m_layout(layout),
+              m_frame(func.is_main || m_alloc.spill_slots || func.args_nb > REG_ARGS_NB) {}
+
+        void run() {
+            string name = m_prog.labels[m_func_labels[m_func.id]];
+            for (const BasicBlock& block : m_func.blocks) {
+                stringstream block_name;
+                block_name << name << "_b" << block.id;
+                m_block_labels.push_back(m_prog.new_label(block_name.str()));
+            }
+            m_epilogue = m_prog.new_label(name + "_end");
+            if (m_func.is_main) {
+                m_map_failed = m_prog.new_label(name + "_no_tape");
+                m_protect_failed = m_prog.new_label(name + "_unmap_tape");
+            }
+            prologue();
+            for (int b = 0; b < (int)m_func.blocks.size(); b++) {
+                // le premier bloc suit directement le prologue
+                if (b) m_prog.emit(MOp::LABEL, label(m_block_labels[b]));
+                int next_block = b+1 < (int)m_func.blocks.size() ? b+1 : -1;
+                for (const Instr& i : m_func.blocks[b].instrs)
+                    instr(i, next_block);
+            }
+            epilogue();
+        }
+};
+
+// Routines du runtime : opérandes dans rdi, rsi et rdx, résultat dans rax ;
+// elles n'utilisent que des registres caller-saved ou de travail.
+class RuntimeCodegen{
+    private :
+        MProgram& m_prog;
+        const vector<int>& m_labels;
+        // position de la zone des tampons par rapport à r15
+        const int32_t m_io;
+        const int64_t m_tape_size;
+        int m_label;
+
+        int new_label(const char* suffix) {
+            return m_prog.new_label(m_prog.labels[m_label] + "_" + suffix + to_string(m_prog.labels.size()));
+        }
+
+        Operand io(int offset) const { return mem(R15, m_io + offset); }
+
+        // saute à fault sauf si [addr, addr+len) est dans le tape ; n'utilise
+        // que rax
+        void check_range(Reg addr, Reg len, int fault) {
+            m_prog.emit(MOp::TEST, reg(addr), reg(addr));
+            m_prog.emit(MOp::JL, label(fault));
+            m_prog.emit(MOp::TEST, reg(len), reg(len));
+            m_prog.emit(MOp::JL, label(fault));
+            m_prog.emit(MOp::MOV, imm_dest(RAX, m_tape_size), imm(m_tape_size));
+            m_prog.emit(MOp::SUB, reg(RAX), reg(addr));
+            m_prog.emit(MOp::JL, label(fault));
+            m_prog.emit(MOp::CMP, reg(len), reg(RAX));
+            m_prog.emit(MOp::JG, label(fault));
+        }
 
-bool Signature::operator==(const Signature& rhs) const {
-    return name == rhs.name && left_arity == rhs.left_arity && right_arity == rhs.right_arity;
+        // plage invalide pour :print et :read, comme pour un appel système
+        // qui renverrait -EFAULT
+        void fault(int label_id) {
+            m_prog.emit(MOp::LABEL, label(label_id));
+            m_prog.emit(MOp::MOV, reg(RAX), imm(-14));
+            m_prog.emit(MOp::RET);
+        }
+
+        // write(1, r15+src, len) si nr vaut 1, read(0, r15+src, len) s'il vaut 0
+        void syscall(int nr, Reg src, Operand len) {
+            m_prog.emit(MOp::LEA, reg(RSI), mem(R15, src, 0, 8));
+            m_prog.emit(MOp::MOV, reg(RDX), len);
+            m_prog.emit(MOp::MOV, reg(RDI, 4), imm(nr));
+            m_prog.emit(MOp::MOV, reg(RAX, 4), imm(nr));
+            m_prog.emit(MOp::SYSCALL);
+        }
+
+        // écrit le tampon de sortie, en recommençant après une écriture
+        // partielle ; rax = octets écrits, ou l'erreur. Le tampon est vidé
+        // même en cas d'erreur. N'utilise que rax, rcx, rdx, rsi, rdi, r8 et r11.
+        void flush() {
+            int loop = new_label("loop"), done = new_label("done"), reset = new_label("reset");
+            m_prog.emit(MOp::XOR, reg(R8, 4), reg(R8, 4));
+            m_prog.emit(MOp::LABEL, label(loop));
+            m_prog.emit(MOp::MOV, reg(RCX), io(IO_OUT_LEN));
+            m_prog.emit(MOp::SUB, reg(RCX), reg(R8));
+            m_prog.emit(MOp::JLE, label(done));
+            m_prog.emit(MOp::LEA, reg(R11), mem(R8, m_io + IO_OUT_BUF));
+            syscall(1, R11, reg(RCX));
+            m_prog.emit(MOp::TEST, reg(RAX), reg(RAX));
+            m_prog.emit(MOp::JLE, label(reset));
+            m_prog.emit(MOp::ADD, reg(R8), reg(RAX));
+            m_prog.emit(MOp::JMP, label(loop));
+            m_prog.emit(MOp::LABEL, label(done));
+            m_prog.emit(MOp::MOV, reg(RAX), reg(R8));
+            m_prog.emit(MOp::LABEL, label(reset));
+            m_prog.emit(MOp::MOV, io(IO_OUT_LEN), imm(0));
+            m_prog.emit(MOp::RET);
+        }
+
+        // rdi = adresse, rsi = longueur ; copie dans le tampon de sortie,
+        // vidé d'abord s'il n'a plus la place. Une écriture plus grande que
+        // le tampon est faite directement.
+        void print() {
+            int copy = new_label("copy"), bad = new_label("fault");
+            check_range(RDI, RSI, bad);
+            m_prog.emit(MOp::MOV, reg(R9), reg(RDI));
+            m_prog.emit(MOp::MOV, reg(R10), reg(RSI));
+            m_prog.emit(MOp::MOV, reg(RAX), io(IO_OUT_LEN));
+            m_prog.emit(MOp::ADD, reg(RAX), reg(RSI));
+            m_prog.emit(MOp::CMP, reg(RAX), imm(IO_BUFFER_SIZE));
+            m_prog.emit(MOp::JLE, label(copy));
+            m_prog.emit(MOp::CALL, label(m_labels[RT_FLUSH]));
+            m_prog.emit(MOp::CMP, reg(R10), imm(IO_BUFFER_SIZE));
+            m_prog.emit(MOp::JL, label(copy));
+            syscall(1, R9, reg(R10));
+            m_prog.emit(MOp::RET);
+            m_prog.emit(MOp::LABEL, label(copy));
+            m_prog.emit(MOp::MOV, reg(RDX), io(IO_OUT_LEN));
+            m_prog.emit(MOp::LEA, reg(RDI), mem(R15, RDX, m_io + IO_OUT_BUF, 8));
+            m_prog.emit(MOp::LEA, reg(RSI), mem(R15, R9, 0, 8));
+            m_prog.emit(MOp::MOV, reg(RCX), reg(R10));
+            m_prog.emit(MOp::REP_MOVSB);
+            m_prog.emit(MOp::ADD, io(IO_OUT_LEN), reg(R10));
+            m_prog.emit(MOp::MOV, reg(RAX), reg(R10));
+            m_prog.emit(MOp::RET);
+            fault(bad);
+        }
+
+        // rdi = adresse, rsi = longueur ; vide la sortie, puis prend ce qui
+        // reste du tampon d'entrée, rempli par un seul read s'il est vide.
+        // Une lecture plus grande que le tampon est faite directement.
+        void read() {
+            int copy = new_label("copy"), fill = new_label("fill"), shorten = new_label("shorten");
+            int done = new_label("done"), bad = new_label("fault");
+            check_range(RDI, RSI, bad);
+            m_prog.emit(MOp::MOV, reg(R9), reg(RDI));
+            m_prog.emit(MOp::MOV, reg(R10), reg(RSI));
+            m_prog.emit(MOp::XOR, reg(RAX, 4), reg(RAX, 4));
+            m_prog.emit(MOp::TEST, reg(RSI), reg(RSI));
+            m_prog.emit(MOp::JE, label(done));
+            m_prog.emit(MOp::CALL, label(m_labels[RT_FLUSH]));
+            m_prog.emit(MOp::MOV, reg(RDX), io(IO_IN_LEN));
+            m_prog.emit(MOp::SUB, reg(RDX), io(IO_IN_POS));
+            m_prog.emit(MOp::JG, label(copy));
+            m_prog.emit(MOp::CMP, reg(R10), imm(IO_BUFFER_SIZE));
+            m_prog.emit(MOp::JL, label(fill));
+            syscall(0, R9, reg(R10));
+            m_prog.emit(MOp::RET);
+            m_prog.emit(MOp::LABEL, label(fill));
+            m_prog.emit(MOp::MOV, reg(R11), imm(m_io + IO_IN_BUF));
+            syscall(0, R11, imm(IO_BUFFER_SIZE));
+            m_prog.emit(MOp::TEST, reg(RAX), reg(RAX));
+            m_prog.emit(MOp::JLE, label(done));
+            m_prog.emit(MOp::MOV, io(IO_IN_LEN), reg(RAX));
+            m_prog.emit(MOp::MOV, io(IO_IN_POS), imm(0));
+            m_prog.emit(MOp::MOV, reg(RDX), reg(RAX));
+            // rdx = octets disponibles, on en prend au plus la longueur demandée
+            m_prog.emit(MOp::LABEL, label(copy));
+            m_prog.emit(MOp::CMP, reg(RDX), reg(R10));
+            m_prog.emit(MOp::JLE, label(shorten));
+            m_prog.emit(MOp::MOV, reg(RDX), reg(R10));
+            m_prog.emit(MOp::LABEL, label(shorten));
+            m_prog.emit(MOp::MOV, reg(RAX), io(IO_IN_POS));
+            m_prog.emit(MOp::LEA, reg(RSI), mem(R15, RAX, m_io + IO_IN_BUF, 8));
+            m_prog.emit(MOp::LEA, reg(RDI), mem(R15, R9, 0, 8));
+            m_prog.emit(MOp::MOV, reg(RCX), reg(RDX));
+            m_prog.emit(MOp::REP_MOVSB);
+            m_prog.emit(MOp::ADD, io(IO_IN_POS), reg(RDX));
+            m_prog.emit(MOp::MOV, reg(RAX), reg(RDX));
+            m_prog.emit(MOp::LABEL, label(done));
+            m_prog.emit(MOp::RET);
+            fault(bad);
+        }
+
+        // plage hors du tape pour un intrinsèque : on lit la page de garde
+        // qui le précède, pour lever SIGSEGV comme un accès hors du tape
+        void out_of_tape(int label_id) {
+            m_prog.emit(MOp::LABEL, label(label_id));
+            m_prog.emit(MOp::MOVZX, reg(RAX, 4), mem(R15, -1, 1));
+        }
+
+        // rdi = destination, rsi = source, rdx = longueur ; rep movsb copie
+        // octet par octet en avançant même quand les plages se chevauchent
+        void memcpy() {
+            int bad = new_label("out_of_tape");
+            check_range(RDI, RDX, bad);
+            check_range(RSI, RDX, bad);
+            m_prog.emit(MOp::MOV, reg(RCX), reg(RDX));
+            m_prog.emit(MOp::MOV, reg(RAX), reg(RDX));
+            m_prog.emit(MOp::LEA, reg(RDI), mem(R15, RDI, 0, 8));
+            m_prog.emit(MOp::LEA, reg(RSI), mem(R15, RSI, 0, 8));
+            m_prog.emit(MOp::REP_MOVSB);
+            m_prog.emit(MOp::RET);
+            out_of_tape(bad);
+        }
+
+        // rdi = destination, rsi = octet, rdx = longueur
+        void memset() {
+            int bad = new_label("out_of_tape");
+            check_range(RDI, RDX, bad);
+            m_prog.emit(MOp::MOV, reg(RCX), reg(RDX));
+            m_prog.emit(MOp::MOV, reg(RAX), reg(RSI));
+            m_prog.emit(MOp::LEA, reg(RDI), mem(R15, RDI, 0, 8));
+            m_prog.emit(MOp::REP_STOSB);
+            m_prog.emit(MOp::MOV, reg(RAX), reg(RDX));
+            m_prog.emit(MOp::RET);
+            out_of_tape(bad);
+        }
+
+        // rdi = adresse, rsi = longueur, rdx = octet cherché. On examine 16
+        // octets à la fois : pcmpeqb les compare à l'octet répété dans xmm0
+        // et pmovmskb en fait un masque, dont bsf donne le premier octet
+        // égal. La fin, de moins de 16 octets, est parcourue octet par octet.
+        void memchr() {
+            int blocks = new_label("blocks"), hit = new_label("hit"), bytes = new_label("bytes");
+            int not_found = new_label("not_found"), found = new_label("found"), bad = new_label("out_of_tape");
+            check_range(RDI, RSI, bad);
+            m_prog.emit(MOp::AND, reg(RDX), imm(0xFF));
+            m_prog.emit(MOp::MOV, reg(R10), imm(0x0101010101010101));
+            m_prog.emit(MOp::IMUL, reg(R10), reg(RDX));
+            m_prog.emit(MOp::MOVQ, xmm(0), reg(R10));
+            m_prog.emit(MOp::PUNPCKLQDQ, xmm(0), xmm(0));
+            m_prog.emit(MOp::LEA, reg(RDI), mem(R15, RDI, 0, 8));
+            m_prog.emit(MOp::XOR, reg(RAX, 4), reg(RAX, 4));
+            m_prog.emit(MOp::LABEL, label(blocks));
+            m_prog.emit(MOp::LEA, reg(RCX), mem(RAX, 16));
+            m_prog.emit(MOp::CMP, reg(RCX), reg(RSI));
+            m_prog.emit(MOp::JG, label(bytes));
+            m_prog.emit(MOp::MOVDQU, xmm(1), mem(RDI, RAX, 0, 16));
+            m_prog.emit(MOp::PCMPEQB, xmm(1), xmm(0));
+            m_prog.emit(MOp::PMOVMSKB, reg(RCX, 4), xmm(1));
+            m_prog.emit(MOp::TEST, reg(RCX, 4), reg(RCX, 4));
+            m_prog.emit(MOp::JNE, label(hit));
+            m_prog.emit(MOp::ADD, reg(RAX), imm(16));
+            m_prog.emit(MOp::JMP, label(blocks));
+            m_prog.emit(MOp::LABEL, label(hit));
+            m_prog.emit(MOp::BSF, reg(RCX, 4), reg(RCX, 4));
+            m_prog.emit(MOp::ADD, reg(RAX), reg(RCX));
+            m_prog.emit(MOp::RET);
+            m_prog.emit(MOp::LABEL, label(bytes));
+            m_prog.emit(MOp::CMP, reg(RAX), reg(RSI));
+            m_prog.emit(MOp::JGE, label(not_found));
+            m_prog.emit(MOp::MOVZX, reg(RCX, 4), mem(RDI, RAX, 0, 1));
+            m_prog.emit(MOp::CMP, reg(RCX), reg(RDX));
+            m_prog.emit(MOp::JE, label(found));
+            m_prog.emit(MOp::ADD, reg(RAX), imm(1));
+            m_prog.emit(MOp::JMP, label(bytes));
+            m_prog.emit(MOp::LABEL, label(not_found));
+            m_prog.emit(MOp::MOV, reg(RAX), imm(-1));
+            m_prog.emit(MOp::LABEL, label(found));
+            m_prog.emit(MOp::RET);
+            out_of_tape(bad);
+        }
+
+        // rdi et rsi = adresses, rdx = longueur ; on compare 16 octets à la
+        // fois avec pcmpeqb, jusqu'au bloc qui diffère, dont bsf donne le
+        // premier octet différent, puis la fin octet par octet
+        void memcmp() {
+            int blocks = new_label("blocks"), block_differs = new_label("block_differs");
+            int bytes = new_label("bytes"), differ = new_label("differ");
+            int equal = new_label("equal"), bad = new_label("out_of_tape");
+            check_range(RDI, RDX, bad);
+            check_range(RSI, RDX, bad);
+            m_prog.emit(MOp::LEA, reg(RDI), mem(R15, RDI, 0, 8));
+            m_prog.emit(MOp::LEA, reg(RSI), mem(R15, RSI, 0, 8));
+            m_prog.emit(MOp::XOR, reg(RAX, 4), reg(RAX, 4));
+            m_prog.emit(MOp::LABEL, label(blocks));
+            m_prog.emit(MOp::LEA, reg(RCX), mem(RAX, 16));
+            m_prog.emit(MOp::CMP, reg(RCX), reg(RDX));
+            m_prog.emit(MOp::JG, label(bytes));
+            m_prog.emit(MOp::MOVDQU, xmm(0), mem(RDI, RAX, 0, 16));
+            m_prog.emit(MOp::MOVDQU, xmm(1), mem(RSI, RAX, 0, 16));
+            m_prog.emit(MOp::PCMPEQB, xmm(0), xmm(1));
+            m_prog.emit(MOp::PMOVMSKB, reg(R8, 4), xmm(0));
+            m_prog.emit(MOp::XOR, reg(R8, 4), imm(0xFFFF));
+            m_prog.emit(MOp::JNE, label(block_differs));
+            m_prog.emit(MOp::MOV, reg(RAX), reg(RCX));
+            m_prog.emit(MOp::JMP, label(blocks));
+            m_prog.emit(MOp::LABEL, label(block_differs));
+            m_prog.emit(MOp::BSF, reg(R8, 4), reg(R8, 4));
+            m_prog.emit(MOp::ADD, reg(RAX), reg(R8));
+            m_prog.emit(MOp::LABEL, label(bytes));
+            m_prog.emit(MOp::CMP, reg(RAX), reg(RDX));
+            m_prog.emit(MOp::JGE, label(equal));
+            m_prog.emit(MOp::MOVZX, reg(RCX, 4), mem(RDI, RAX, 0, 1));
+            m_prog.emit(MOp::MOVZX, reg(R8, 4), mem(RSI, RAX, 0, 1));
+            m_prog.emit(MOp::SUB, reg(RCX), reg(R8));
+            m_prog.emit(MOp::JNE, label(differ));
+            m_prog.emit(MOp::ADD, reg(RAX), imm(1));
+            m_prog.emit(MOp::JMP, label(bytes));
+            m_prog.emit(MOp::LABEL, label(differ));
+            m_prog.emit(MOp::MOV, reg(RAX), reg(RCX));
+            m_prog.emit(MOp::RET);
+            m_prog.emit(MOp::LABEL, label(equal));
+            m_prog.emit(MOp::XOR, reg(RAX, 4), reg(RAX, 4));
+            m_prog.emit(MOp::RET);
+            out_of_tape(bad);
+        }
+
+    public :
+        RuntimeCodegen(MProgram& prog, const vector<int>& labels, const TapeLayout& layout)
+            : m_prog(prog), m_labels(labels), m_io(layout.io), m_tape_size(layout.tape.size) {}
+
+        void run(int routine) {
+            m_label = m_labels[routine];
+            m_prog.emit(MOp::LABEL, label(m_label));
+            switch (routine) {
+                case RT_MEMCPY: memcpy(); break;
+                case RT_MEMSET: memset(); break;
+                case RT_MEMCHR: memchr(); break;
+                case RT_MEMCMP: memcmp(); break;
+                case RT_PRINT: print(); break;
+                case RT_READ: read(); break;
+                case RT_FLUSH: flush(); break;
+            }
+        }
+};
+
+MProgram codegen(IRModule module, bool main_returns, bool buffered_io) {
+    MProgram prog;
+    // environ deux instructions machine par instruction d'IR : réserver évite
+    // les recopies du vecteur, coûteuses en mémoire sur les gros programmes
+    size_t instrs_nb = 0;
+    for (const IRFunction& func : module.funcs)
+        for (const BasicBlock& block : func.blocks)
+            instrs_nb += block.instrs.size() + 1;
+    prog.code.reserve(2*instrs_nb);
+    vector<int> func_labels;
+    for (const IRFunction& func : module.funcs) {
+        if (func.is_main) {
+            func_labels.push_back(prog.new_label("_start"));
+            prog.entry = func_labels.back();
+        } else
+            func_labels.push_back(prog.new_label("op" + to_string(func.id)));
+    }
+    // seules les routines utilisées sont émises ; print et read vident la
+    // sortie, et main aussi en terminant
+    vector<int> routine_labels(ROUTINES_NB, -1);
+    for (const IRFunction& func : module.funcs)
+        for (const BasicBlock& block : func.blocks)
+            for (const Instr& instr : block.instrs) {
+                int r = routine(instr, buffered_io);
+                if (r != -1) routine_labels[r] = 1;
+                if (r == RT_PRINT || r == RT_READ) routine_labels[RT_FLUSH] = 1;
+            }
+    for (int r = 0; r < ROUTINES_NB; r++)
+        if (routine_labels[r] != -1) routine_labels[r] = prog.new_label(routine_names[r]);
+    TapeLayout layout{module.tape, module.memo_size, routine_labels[RT_FLUSH] != -1 ? IO_REGION_SIZE : 0};
+    // chaque fonction est libérée dès qu'elle est traduite ; une fonction
+    // sans bloc n'est plus appelée et n'est pas émise
+    for (IRFunction& func : module.funcs) {
+        if (func.blocks.empty()) continue;
+        FunctionCodegen(func, prog, func_labels, routine_labels, main_returns, layout).run();
+        func.blocks = {};
+    }
+    RuntimeCodegen runtime{prog, routine_labels, layout};
+    for (int r = 0; r < ROUTINES_NB; r++)
+        if (routine_labels[r] != -1) runtime.run(r);
+    return prog;
 }
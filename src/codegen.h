@@ -1,17 +1,23 @@
 #ifndef CODEGEN_H
 #define CODEGEN_H
 
-#include <fstream>
+#include "ir.h"
+#include "x86.h"
+
+#include <stdexcept>
 #include <unordered_map>
 #include <string>
 #include <vector>
 
-#define TAPE_SIZE 80000
+// taille des tampons d'entrée et de sortie de :read et :print
+#define IO_BUFFER_SIZE 4096
+// registre virtuel d'une variable qui n'est pas définie dans la portée courante
+#define NO_VREG -1
 
 using namespace std;
 
 struct Signature{
-    string name;
+    int sym;
     int left_arity, right_arity;
     bool operator==(const Signature& rhs) const;
 };
@@ -23,9 +29,10 @@ template<> struct std::hash<Signature>{
 class Scope; 
 
 struct Environement{
-    unordered_map<string, int> adress_table;
-    vector<string> stack_frame;
-    int curr_addr;
+    // registre virtuel de chaque variable indexé par symbole, NO_VREG si
+    // la variable n'est pas définie
+    vector<int> var_table;
+    vector<int> stack_frame;
     unordered_map<Signature, int> op_ids;
     int ops_nb = 0;
     Scope* curr_scope;
@@ -36,4 +43,15 @@ class SemanticError : public std::runtime_error{
         using std::runtime_error::runtime_error;
 };
 
+// traduit l'IR en instructions x86-64, après allocation des registres.
+// Si main_returns, main est une fonction de la convention C qui retourne
+// son résultat au lieu de le passer à exit, pour être appelée par run_jit
+// sur la pile dont elle reçoit le sommet, avec l'adresse où écrire -errno
+// si le tape ne peut être projeté. main projette le tape par mmap, entre
+// deux pages de garde, précédé des zones de mémoïsation et des tampons.
+// Si buffered_io, :print et :read passent par ces tampons, et la sortie
+// est vidée par :flush, avant chaque :read et à la fin de main ; sinon
+// chacun est un appel système.
+MProgram codegen(IRModule module, bool main_returns = false, bool buffered_io = true);
+
 #endif
@@ -0,0 +1,333 @@
+#include "x86.h"
+#include "source.h"
+
+#include <cerrno>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// code de condition des jcc et setcc
+static uint8_t condition(MOp op) {
+    switch (op) {
+        case MOp::JE: case MOp::SETE: return 0x4;
+        case MOp::JNE: case MOp::SETNE: return 0x5;
+        case MOp::JL: case MOp::SETL: return 0xC;
+        case MOp::JGE: case MOp::SETGE: return 0xD;
+        case MOp::JLE: case MOp::SETLE: return 0xE;
+        default: return 0xF;
+    }
+}
+
+static bool fits_imm8(int64_t val) { return val == (int8_t)val; }
+
+static bool is_jump(MOp op) { return op >= MOp::JMP && op <= MOp::JGE; }
+
+// spl, bpl, sil et dil ne sont accessibles qu'avec un préfixe REX
+static bool needs_rex(const Operand& op) {
+    return op.kind == Operand::REG && op.size == 1 && op.base >= RSP && op.base <= RDI;
+}
+
+// encode les instructions sans label, une par une, à la suite de out
+class Encoder{
+    private :
+        vector<uint8_t>& m_out;
+
+        void byte(uint8_t b) { m_out.push_back(b); }
+        void imm(int64_t val, int size) {
+            for (int i = 0; i < size; i++) byte(val >> 8*i);
+        }
+
+        // [REX] opcode ModRM [SIB] [déplacement], reg étant un registre ou
+        // l'extension /n de l'opcode et rm un registre ou un accès mémoire
+        void op_rm(int size, initializer_list<uint8_t> opcode, const Operand& reg, const Operand& rm) {
+            int r = reg.kind == Operand::REG ? (int)reg.base : reg.val;
+            // préfixe de taille d'opérande 16 bits, avant REX
+            if (size == 2) byte(0x66);
+            uint8_t rex = 0x40 | (size == 8) << 3 | (r & 8) >> 1 | (rm.base & 8) >> 3;
+            if (rm.kind == Operand::MEM && rm.index != NO_REG) rex |= (rm.index & 8) >> 2;
+            if (rex != 0x40 || needs_rex(reg) || needs_rex(rm)) byte(rex);
+            for (uint8_t b : opcode) byte(b);
+            if (rm.kind == Operand::REG) {
+                byte(0xC0 | (r & 7) << 3 | (rm.base & 7));
+                return;
+            }
+            int base = rm.base & 7;
+            int32_t disp = rm.val;
+            // rbp et r13 comme base imposent un déplacement
+            int mod = disp == 0 && base != RBP ? 0 : fits_imm8(disp) ? 1 : 2;
+            // rsp et r12 comme base imposent un octet SIB
+            if (rm.index != NO_REG || base == RSP) {
+                byte(mod << 6 | (r & 7) << 3 | 4);
+                byte((rm.index == NO_REG ? 4 : rm.index & 7) << 3 | base);
+            } else
+                byte(mod << 6 | (r & 7) << 3 | base);
+            if (mod == 1) imm(disp, 1);
+            else if (mod == 2) imm(disp, 4);
+        }
+
+        // instruction SSE2 0F op, précédée de son préfixe obligatoire, qui
+        // doit être avant REX ; size 8 pour REX.W
+        void sse(uint8_t prefix, uint8_t op, const Operand& reg, const Operand& rm, int size = 4) {
+            byte(prefix);
+            op_rm(size, {0x0F, op}, reg, rm);
+        }
+
+        // extension /n de l'opcode, dans le champ reg du ModRM
+        static Operand ext(int n) { return {Operand::IMM, 8, NO_REG, NO_REG, n}; }
+
+        void mov(const Operand& dst, const Operand& src) {
+            if (src.kind == Operand::IMM) {
+                int64_t val = src.val;
+                if (dst.kind == Operand::MEM) {
+                    op_rm(dst.size, {(uint8_t)(dst.size == 1 ? 0xC6 : 0xC7)}, ext(0), dst);
+                    imm(val, dst.size < 4 ? dst.size : 4);
+                } else if (dst.size == 8 && val < 0 && fits_imm32(val)) {
+                    op_rm(8, {0xC7}, ext(0), dst);
+                    imm(val, 4);
+                } else {
+                    // mov r32, imm32 met à zéro la moitié haute du registre
+                    bool wide = dst.size == 8 && (uint64_t)val > 0xFFFFFFFF;
+                    uint8_t rex = 0x40 | wide << 3 | (dst.base & 8) >> 3;
+                    if (rex != 0x40) byte(rex);
+                    byte(0xB8 | (dst.base & 7));
+                    imm(val, wide ? 8 : 4);
+                }
+            } else if (src.kind == Operand::REG)
+                op_rm(src.size, {(uint8_t)(src.size == 1 ? 0x88 : 0x89)}, src, dst);
+            else
+                op_rm(dst.size, {(uint8_t)(dst.size == 1 ? 0x8A : 0x8B)}, dst, src);
+        }
+
+        // add, or, and, sub, xor et cmp ne diffèrent que par n
+        void alu(int n, const Operand& dst, const Operand& src) {
+            if (src.kind == Operand::IMM) {
+                bool short_imm = fits_imm8(src.val);
+                op_rm(dst.size, {(uint8_t)(short_imm ? 0x83 : 0x81)}, ext(n), dst);
+                imm(src.val, short_imm ? 1 : 4);
+            } else if (src.kind == Operand::REG)
+                op_rm(dst.size, {(uint8_t)(8*n + 1)}, src, dst);
+            else
+                op_rm(dst.size, {(uint8_t)(8*n + 3)}, dst, src);
+        }
+
+    public :
+        Encoder(vector<uint8_t>& out) : m_out(out) {}
+
+        void instr(const MInstr& instr) {
+            const Operand& dst = instr.dst;
+            const Operand& src = instr.src;
+            switch (instr.op) {
+                case MOp::MOV: mov(dst, src); break;
+                case MOp::MOVZX: op_rm(dst.size, {0x0F, (uint8_t)(src.size == 1 ? 0xB6 : 0xB7)}, dst, src); break;
+                case MOp::LEA: op_rm(8, {0x8D}, dst, src); break;
+                case MOp::ADD: alu(0, dst, src); break;
+                case MOp::OR: alu(1, dst, src); break;
+                case MOp::AND: alu(4, dst, src); break;
+                case MOp::SUB: alu(5, dst, src); break;
+                case MOp::XOR: alu(6, dst, src); break;
+                case MOp::CMP: alu(7, dst, src); break;
+                case MOp::TEST: op_rm(dst.size, {0x85}, src, dst); break;
+                case MOp::BSF: op_rm(dst.size, {0x0F, 0xBC}, dst, src); break;
+                case MOp::IMUL:
+                    if (src.kind != Operand::IMM)
+                        op_rm(8, {0x0F, 0xAF}, dst, src);
+                    else if (fits_imm8(src.val)) {
+                        op_rm(8, {0x6B}, dst, dst);
+                        imm(src.val, 1);
+                    } else {
+                        op_rm(8, {0x69}, dst, dst);
+                        imm(src.val, 4);
+                    }
+                    break;
+                case MOp::MUL: op_rm(8, {0xF7}, ext(4), dst); break;
+                case MOp::IDIV: op_rm(8, {0xF7}, ext(7), dst); break;
+                case MOp::NEG: op_rm(8, {0xF7}, ext(3), dst); break;
+                case MOp::SHL: case MOp::SHR:
+                    op_rm(8, {0xC1}, ext(instr.op == MOp::SHL ? 4 : 5), dst);
+                    imm(src.val, 1);
+                    break;
+                case MOp::SETE: case MOp::SETNE: case MOp::SETL:
+                case MOp::SETLE: case MOp::SETG: case MOp::SETGE:
+                    op_rm(1, {0x0F, (uint8_t)(0x90 | condition(instr.op))}, ext(0), dst);
+                    break;
+                case MOp::PUSH:
+                    if (dst.kind == Operand::REG) {
+                        if (dst.base & 8) byte(0x41);
+                        byte(0x50 | (dst.base & 7));
+                    } else if (dst.kind == Operand::IMM) {
+                        byte(fits_imm8(dst.val) ? 0x6A : 0x68);
+                        imm(dst.val, fits_imm8(dst.val) ? 1 : 4);
+                    } else
+                        op_rm(4, {0xFF}, ext(6), dst);
+                    break;
+                case MOp::POP:
+                    if (dst.base & 8) byte(0x41);
+                    byte(0x58 | (dst.base & 7));
+                    break;
+                case MOp::RET: byte(0xC3); break;
+                case MOp::SYSCALL: byte(0x0F); byte(0x05); break;
+                case MOp::REP_MOVSB: byte(0xF3); byte(0xA4); break;
+                case MOp::REP_STOSB: byte(0xF3); byte(0xAA); break;
+                case MOp::MOVQ: sse(0x66, 0x6E, dst, src, 8); break;
+                case MOp::MOVDQU: sse(0xF3, 0x6F, dst, src); break;
+                case MOp::PUNPCKLQDQ: sse(0x66, 0x6C, dst, src); break;
+                case MOp::PCMPEQB: sse(0x66, 0x74, dst, src); break;
+                case MOp::PMOVMSKB: sse(0x66, 0xD7, dst, src); break;
+                default: break;
+            }
+        }
+};
+
+MachineCode encode(const MProgram& prog) {
+    const vector<MInstr>& code = prog.code;
+    size_t n = code.size();
+    // les instructions sans label sont encodées une fois pour toutes ;
+    // start[i] est la position des octets de l'instruction i dans fixed
+    vector<uint8_t> fixed;
+    fixed.reserve(4*n);
+    vector<uint32_t> start(n+1);
+    Encoder enc{fixed};
+    for (size_t i = 0; i < n; i++) {
+        start[i] = fixed.size();
+        enc.instr(code[i]);
+    }
+    start[n] = fixed.size();
+
+    // les sauts sont d'abord courts (rel8) ; on allonge ceux dont la cible
+    // est trop loin, ce qui peut en éloigner d'autres, jusqu'au point fixe
+    vector<char> near(n, 1);
+    vector<uint32_t> label_pos(prog.labels.size());
+    vector<uint32_t> offset(n+1);
+    auto size = [&](size_t i) -> uint32_t {
+        MOp op = code[i].op;
+        if (op == MOp::CALL) return 5;
+        if (is_jump(op)) return near[i] ? 2 : op == MOp::JMP ? 5 : 6;
+        return start[i+1] - start[i];
+    };
+    for (bool changed = true; changed; ) {
+        uint32_t pos = 0;
+        for (size_t i = 0; i < n; i++) {
+            offset[i] = pos;
+            if (code[i].op == MOp::LABEL) label_pos[code[i].dst.val] = pos;
+            pos += size(i);
+        }
+        offset[n] = pos;
+        changed = false;
+        for (size_t i = 0; i < n; i++)
+            if (is_jump(code[i].op) && near[i]
+                    && !fits_imm8((int64_t)label_pos[code[i].dst.val] - (offset[i] + 2))) {
+                near[i] = 0;
+                changed = true;
+            }
+    }
+
+    MachineCode res;
+    vector<uint8_t>& text = res.text;
+    text.reserve(offset[n]);
+    auto rel = [&](size_t i, int bytes) {
+        int64_t disp = (int64_t)label_pos[code[i].dst.val] - (offset[i] + size(i));
+        for (int k = 0; k < bytes; k++) text.push_back(disp >> 8*k);
+    };
+    for (size_t i = 0; i < n; i++) {
+        MOp op = code[i].op;
+        if (op == MOp::CALL) {
+            text.push_back(0xE8);
+            rel(i, 4);
+        } else if (op == MOp::JMP) {
+            text.push_back(near[i] ? 0xEB : 0xE9);
+            rel(i, near[i] ? 1 : 4);
+        } else if (is_jump(op)) {
+            if (near[i]) text.push_back(0x70 | condition(op));
+            else {
+                text.push_back(0x0F);
+                text.push_back(0x80 | condition(op));
+            }
+            rel(i, near[i] ? 1 : 4);
+        } else
+            text.insert(text.end(), fixed.begin() + start[i], fixed.begin() + start[i+1]);
+    }
+    res.entry = label_pos[prog.entry];
+    return res;
+}
+
+static IOError io_error(const char* what, const char* path) {
+    stringstream err;
+    err << what << " \"" << path << "\": " << strerror(errno);
+    return IOError(err.str());
+}
+
+void write_elf(const char* path, const MachineCode& code) {
+    // un seul segment lisible et exécutable contenant les en-têtes puis le code
+    const uint64_t base = 0x400000;
+    const uint64_t headers_size = sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr);
+
+    Elf64_Ehdr ehdr = {};
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = ET_EXEC;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_entry = base + headers_size + code.entry;
+    ehdr.e_phoff = sizeof(Elf64_Ehdr);
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    ehdr.e_phnum = 1;
+
+    Elf64_Phdr phdr = {};
+    phdr.p_type = PT_LOAD;
+    phdr.p_flags = PF_R | PF_X;
+    phdr.p_vaddr = phdr.p_paddr = base;
+    phdr.p_filesz = phdr.p_memsz = headers_size + code.text.size();
+    phdr.p_align = 0x1000;
+
+    // comme ld, on remplace le fichier plutôt que de le réécrire, ce qui
+    // échouerait si l'ancien exécutable tourne encore
+    unlink(path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    if (fd == -1) throw io_error("cannot create", path);
+    bool ok = write(fd, &ehdr, sizeof(ehdr)) == sizeof(ehdr)
+        && write(fd, &phdr, sizeof(phdr)) == sizeof(phdr)
+        && write(fd, code.text.data(), code.text.size()) == (ssize_t)code.text.size();
+    close(fd);
+    if (!ok) throw io_error("cannot write", path);
+}
+
+int64_t run_jit(const MachineCode& code) {
+    size_t size = code.text.size();
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) throw IOError(string("cannot map code: ") + strerror(errno));
+    memcpy(mem, code.text.data(), size);
+    // jamais écrivable et exécutable à la fois
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) == -1) {
+        munmap(mem, size);
+        throw IOError(string("cannot map code: ") + strerror(errno));
+    }
+    // le programme tourne sur sa propre pile, de la taille de celle d'un
+    // processus, dont une récursion trop profonde atteint la page de garde
+    // du bas ; main projette elle-même le tape et les zones réservées
+    struct rlimit limit;
+    getrlimit(RLIMIT_STACK, &limit);
+    size_t stack_size = limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > (1ull << 36)
+        ? 1ull << 36 : limit.rlim_cur & ~(size_t)0xFFF;
+    void* stack = mmap(nullptr, stack_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED || mprotect(stack, 0x1000, PROT_NONE) == -1) {
+        munmap(mem, size);
+        throw IOError(string("cannot map stack: ") + strerror(errno));
+    }
+    // main écrit dans error -errno si elle ne peut projeter le tape
+    int64_t error = 0;
+    auto entry = (int64_t (*)(void*, int64_t*))((uint8_t*)mem + code.entry);
+    int64_t res = entry((uint8_t*)stack + stack_size, &error);
+    munmap(stack, stack_size);
+    munmap(mem, size);
+    if (error) throw IOError(string("cannot map the tape: ") + strerror(-error));
+    return res;
+}
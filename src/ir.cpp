@@ -0,0 +1,201 @@
+#include "ir.h"
+#include "lexer.h"
+
+#include <algorithm>
+
+vector<int> IRFunction::successors(const BasicBlock& block) const {
+    if (block.instrs.empty()) return {};
+    const Instr& last = block.instrs.back();
+    if (last.op == IROp::JMP) return {last.target};
+    if (last.op == IROp::BR) return {last.target, last.target2};
+    return {};
+}
+
+void IRFunction::insert_blocks(int pos, int count) {
+    for (BasicBlock& block : blocks)
+        for (Instr& instr : block.instrs) {
+            if (instr.target >= pos) instr.target += count;
+            if (instr.target2 >= pos) instr.target2 += count;
+        }
+    blocks.insert(blocks.begin()+pos, count, BasicBlock{});
+    for (int b = 0; b < (int)blocks.size(); b++)
+        blocks[b].id = b;
+}
+
+int IRBuilder::new_block() {
+    int id = m_func->blocks.size();
+    m_func->blocks.push_back({id, {}});
+    return id;
+}
+
+bool IRBuilder::terminated() const {
+    const BasicBlock& block = m_func->blocks[m_block];
+    return !block.instrs.empty() && block.instrs.back().is_terminator();
+}
+
+Instr& IRBuilder::emit(IROp op, Value dst, Value a, Value b) {
+    vector<Instr>& instrs = m_func->blocks[m_block].instrs;
+    instrs.push_back({op, dst, a, b});
+    return instrs.back();
+}
+
+Value IRBuilder::binop(IROp op, Value a, Value b) {
+    Value dst = Value::vreg(new_vreg());
+    emit(op, dst, a, b);
+    return dst;
+}
+
+void IRBuilder::br(Value cond, int target, int target2) {
+    Instr& instr = emit(IROp::BR, {}, cond, Value::imm(0));
+    instr.target = target;
+    instr.target2 = target2;
+}
+
+void IRBuilder::jmp(int target) {
+    emit(IROp::JMP).target = target;
+}
+
+bool eval_binop(IROp op, int64_t a, int64_t b, int64_t& res) {
+    // arithmétique modulo 2^64, comme les instructions x86
+    uint64_t ua = a, ub = b;
+    switch (op) {
+        case IROp::ADD: res = ua + ub; return true;
+        case IROp::SUB: res = ua - ub; return true;
+        case IROp::MUL: res = ua * ub; return true;
+        case IROp::DIV: case IROp::MOD: {
+            // idiv sur rdx:rax = 0:a, le dividende est donc a non signé
+            if (b == 0) return false;
+            __int128 q = (__int128)ua / b;
+            if (q != (int64_t)q) return false;
+            res = op == IROp::DIV ? (int64_t)q : (int64_t)((__int128)ua % b);
+            return true;
+        }
+        // comme shl et shr, seuls les 6 bits de poids faible du décalage comptent
+        case IROp::SHL: res = ua << (b & 63); return true;
+        case IROp::SHR: res = ua >> (b & 63); return true;
+        case IROp::AND: res = a & b; return true;
+        case IROp::OR: res = a | b; return true;
+        case IROp::EQ: res = a == b; return true;
+        case IROp::NE: res = a != b; return true;
+        case IROp::LT: res = a < b; return true;
+        case IROp::LE: res = a <= b; return true;
+        case IROp::GT: res = a > b; return true;
+        case IROp::GE: res = a >= b; return true;
+        default: return false;
+    }
+}
+
+IROp swap_comparison(IROp cond) {
+    switch (cond) {
+        case IROp::LT: return IROp::GT;
+        case IROp::LE: return IROp::GE;
+        case IROp::GT: return IROp::LT;
+        case IROp::GE: return IROp::LE;
+        default: return cond;
+    }
+}
+
+IROp negate_comparison(IROp cond) {
+    switch (cond) {
+        case IROp::EQ: return IROp::NE;
+        case IROp::NE: return IROp::EQ;
+        case IROp::LT: return IROp::GE;
+        case IROp::LE: return IROp::GT;
+        case IROp::GT: return IROp::LE;
+        default: return IROp::LT;
+    }
+}
+
+// union de deux ensembles triés
+static vector<int> merge_sets(const vector<int>& a, const vector<int>& b) {
+    vector<int> res;
+    res.reserve(a.size() + b.size());
+    set_union(a.begin(), a.end(), b.begin(), b.end(), back_inserter(res));
+    return res;
+}
+
+Liveness compute_liveness(const IRFunction& func) {
+    int n = func.blocks.size();
+    vector<vector<int>> uses(n), defs(n);
+    for (const BasicBlock& block : func.blocks) {
+        vector<int>& use = uses[block.id];
+        vector<int>& def = defs[block.id];
+        for (const Instr& instr : block.instrs) {
+            instr.for_each_use([&](int v) {
+                if (!binary_search(def.begin(), def.end(), v)) use.push_back(v);
+            });
+            if (instr.dst.is_vreg())
+                def.insert(lower_bound(def.begin(), def.end(), instr.dst.val), instr.dst.val);
+        }
+        sort(use.begin(), use.end());
+        use.erase(unique(use.begin(), use.end()), use.end());
+        def.erase(unique(def.begin(), def.end()), def.end());
+    }
+    Liveness res{vector<vector<int>>(n), vector<vector<int>>(n)};
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int b = n-1; b >= 0; b--) {
+            vector<int> out;
+            for (int succ : func.successors(func.blocks[b]))
+                out = merge_sets(out, res.live_in[succ]);
+            vector<int> in;
+            set_difference(out.begin(), out.end(), defs[b].begin(), defs[b].end(), back_inserter(in));
+            in = merge_sets(in, uses[b]);
+            if (in != res.live_in[b] || out != res.live_out[b]) {
+                res.live_in[b] = std::move(in);
+                res.live_out[b] = std::move(out);
+                changed = true;
+            }
+        }
+    }
+    return res;
+}
+
+static const char* op_names[] = {
+    "copy", "add", "sub", "mul", "div", "mod", "shl", "shr", "and", "or",
+    "eq", "ne", "lt", "le", "gt", "ge", "arg", "load", "store", "mload", "mstore",
+    "call", "tailcall", "print", "read", "flush",
+    "memcpy", "memset", "memchr", "memcmp", "ret", "br", "jmp"
+};
+
+static ostream& operator<<(ostream& out, const Value& val) {
+    if (val.is_vreg()) return out << '%' << val.val;
+    return out << val.val;
+}
+
+void print_ir(ostream& out, const IRModule& module) {
+    for (const IRFunction& func : module.funcs) {
+        if (func.blocks.empty()) continue;
+        out << "function op" << func.id << " \"" << symbols.name(func.sym) << "\" ("
+            << func.args_nb << " args, " << func.vregs_nb << " vregs)\n";
+        for (const BasicBlock& block : func.blocks) {
+            out << "b" << block.id << ":\n";
+            for (const Instr& instr : block.instrs) {
+                out << '\t';
+                if (instr.dst.kind != Value::NONE) out << instr.dst << " = ";
+                out << op_names[(int)instr.op];
+                if ((instr.op == IROp::LOAD || instr.op == IROp::STORE) && instr.width != 1)
+                    out << instr.width;
+                if (instr.op == IROp::BR && (instr.cond != IROp::NE || instr.b != Value::imm(0)))
+                    out << ' ' << op_names[(int)instr.cond];
+                bool plain_br = instr.op == IROp::BR && instr.cond == IROp::NE && instr.b == Value::imm(0);
+                if (instr.callee != -1) out << " op" << instr.callee;
+                const char* sep = " ";
+                for (const Value* val : {&instr.a, &instr.b})
+                    if (val->kind != Value::NONE && !(plain_br && val == &instr.b)) {
+                        out << sep << *val;
+                        sep = ", ";
+                    }
+                for (const Value& arg : instr.args) {
+                    out << sep << arg;
+                    sep = ", ";
+                }
+                if (instr.target != -1) out << sep << "b" << instr.target;
+                if (instr.target2 != -1) out << ", b" << instr.target2;
+                out << '\n';
+            }
+        }
+        out << '\n';
+    }
+}
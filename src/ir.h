@@ -0,0 +1,215 @@
+#ifndef IR_H
+#define IR_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+using namespace std;
+
+// Représentation intermédiaire à trois adresses entre l'AST et l'assembleur.
+// Chaque opérateur devient une IRFunction dont les blocs de base manipulent
+// un nombre illimité de registres virtuels, alloués ensuite par regalloc.
+
+// opérande d'une instruction : registre virtuel ou constante
+struct Value{
+    enum Kind : uint8_t {
+        NONE, VREG, IMM
+    } kind = NONE;
+    // numéro du registre virtuel ou valeur de la constante
+    int64_t val = 0;
+
+    static Value vreg(int n) { return {VREG, n}; }
+    static Value imm(int64_t n) { return {IMM, n}; }
+    bool is_vreg() const { return kind == VREG; }
+    bool is_imm() const { return kind == IMM; }
+    bool operator==(const Value& rhs) const { return kind == rhs.kind && val == rhs.val; }
+    bool operator!=(const Value& rhs) const { return !(*this == rhs); }
+};
+
+enum class IROp : uint8_t {
+    COPY,       // dst = a
+    ADD,        // dst = a + b
+    SUB,        // dst = a - b
+    MUL,        // dst = a * b
+    DIV,        // dst = a / b, dividende non signé comme "xor rdx, rdx / idiv"
+    MOD,        // dst = a - (a / b) * b, le reste laissé dans rdx par idiv
+    SHL,        // dst = a << b
+    SHR,        // dst = a >> b, décalage logique
+    AND,        // dst = a & b
+    OR,         // dst = a | b
+    EQ,         // dst = a == b, comparaisons signées valant 0 ou 1
+    NE,         // dst = a != b
+    LT,         // dst = a < b
+    LE,         // dst = a <= b
+    GT,         // dst = a > b
+    GE,         // dst = a >= b
+    ARG,        // dst = argument numéro a de la fonction
+    LOAD,       // dst = les width octets du tape à partir de a, en little endian
+    STORE,      // les width octets du tape à partir de a = les width octets de poids faible de b
+    MLOAD,      // dst = mot de 64 bits à l'octet a de la zone de mémoïsation
+    MSTORE,     // mot de 64 bits à l'octet a de la zone de mémoïsation = b
+    CALL,       // dst = fonction callee appliquée à args
+    TAILCALL,   // retourne la fonction callee appliquée à args, en réutilisant le cadre
+    PRINT,      // dst = write(1, tape+a, b), à travers le tampon de sortie
+    READ,       // dst = read(0, tape+a, b), à travers le tampon d'entrée
+    FLUSH,      // vide le tampon de sortie ; dst = nombre d'octets écrits
+    // intrinsèques sur des plages du tape, dont les opérandes sont args ;
+    // une plage qui sort du tape lève SIGSEGV comme un accès hors du tape
+    MEMCPY,     // copie args[2] octets de args[1] vers args[0], octet par octet
+                // en avançant ; dst = nombre d'octets copiés
+    MEMSET,     // args[2] octets à args[1] à partir de args[0] ; dst = nombre d'octets écrits
+    MEMCHR,     // dst = position du premier octet args[2] parmi les args[1] octets
+                // à partir de args[0], -1 s'il n'y en a pas
+    MEMCMP,     // dst = différence des premiers octets qui diffèrent parmi les
+                // args[2] à partir de args[0] et args[1], 0 s'il n'y en a pas
+    RET,        // retourne a
+    BR,         // si a cond b aller au bloc target sinon au bloc target2
+    JMP,        // aller au bloc target
+};
+
+struct Instr{
+    IROp op;
+    Value dst, a, b;
+    int target = -1, target2 = -1;
+    int callee = -1;
+    vector<Value> args;
+    // BR : comparaison entre a et b, de EQ à GE
+    IROp cond = IROp::NE;
+    // LOAD et STORE : taille de l'accès, 1, 2, 4 ou 8 octets
+    int width = 1;
+
+    bool is_terminator() const {
+        return op == IROp::RET || op == IROp::BR || op == IROp::JMP || op == IROp::TAILCALL;
+    }
+    // appelle une fonction ou fait un appel système : détruit les registres caller-saved
+    bool is_call() const {
+        return op == IROp::CALL || op == IROp::PRINT || op == IROp::READ || op == IROp::FLUSH
+            || is_intrinsic();
+    }
+    // appel d'une routine du compilateur, de MEMCPY à MEMCMP
+    bool is_intrinsic() const { return op >= IROp::MEMCPY && op <= IROp::MEMCMP; }
+    bool writes_tape() const {
+        return op == IROp::STORE || op == IROp::READ || op == IROp::MEMCPY || op == IROp::MEMSET;
+    }
+    bool reads_tape() const {
+        return op == IROp::LOAD || op == IROp::PRINT || op == IROp::MEMCPY
+            || op == IROp::MEMCHR || op == IROp::MEMCMP;
+    }
+    // registres virtuels lus par l'instruction
+    template <typename F> void for_each_use(F f) const {
+        if (a.is_vreg() && op != IROp::ARG) f((int)a.val);
+        if (b.is_vreg()) f((int)b.val);
+        for (const Value& arg : args)
+            if (arg.is_vreg()) f((int)arg.val);
+    }
+    // idem, en permettant de remplacer les opérandes lus
+    template <typename F> void map_uses(F f) {
+        if (a.is_vreg() && op != IROp::ARG) f(a);
+        if (b.is_vreg()) f(b);
+        for (Value& arg : args)
+            if (arg.is_vreg()) f(arg);
+    }
+    // l'instruction fait-elle autre chose que calculer dst
+    bool has_side_effects() const {
+        // une division par zéro arrête le programme, comme une division par
+        // 1 ou -1 d'un dividende négatif : idiv divise 0:a et le quotient déborde
+        bool may_trap = (op == IROp::DIV || op == IROp::MOD)
+            && !(b.is_imm() && b.val != 0 && b.val != 1 && b.val != -1);
+        return is_terminator() || is_call() || op == IROp::STORE || op == IROp::MSTORE || may_trap;
+    }
+};
+
+struct BasicBlock{
+    int id;
+    vector<Instr> instrs;
+};
+
+// le code natif passe les REG_ARGS_NB premiers arguments d'un appel en
+// registres et empile les suivants
+#define REG_ARGS_NB 6
+
+struct IRFunction{
+    int id;
+    int sym;
+    int args_nb = 0;
+    bool is_main = false;
+    int vregs_nb = 0;
+    vector<BasicBlock> blocks;
+
+    // successeurs du bloc, d'après son terminateur
+    vector<int> successors(const BasicBlock& block) const;
+    // insère count blocs vides à la position pos en renumérotant les suivants
+    void insert_blocks(int pos, int count);
+};
+
+// le tape occupe des pages entières, pour que ses deux bords touchent une
+// page de garde : sa taille est arrondie à un multiple de TAPE_PAGE_SIZE
+#define TAPE_PAGE_SIZE 4096
+#define DEFAULT_TAPE_SIZE (20*TAPE_PAGE_SIZE)
+// taille maximale du tape, dont les pages ne sont allouées qu'au premier accès
+#define MAX_TAPE_SIZE (int64_t(1) << 40)
+
+// tape du programme, projeté par mmap à son lancement
+struct TapeConfig{
+    int64_t size = DEFAULT_TAPE_SIZE;
+    // alloue toutes les pages au lancement plutôt qu'au premier accès
+    bool populate = false;
+    // demande des pages de 2 Mo, s'il y en a
+    bool huge_pages = false;
+};
+
+struct IRModule{
+    vector<IRFunction> funcs;
+    // taille en octets de la zone de mémoïsation, réservée avant le tape
+    int64_t memo_size = 0;
+    TapeConfig tape;
+};
+
+inline bool is_comparison(IROp op) { return op >= IROp::EQ && op <= IROp::GE; }
+// a cond b <=> b swap_comparison(cond) a
+IROp swap_comparison(IROp cond);
+// a cond b <=> !(a negate_comparison(cond) b)
+IROp negate_comparison(IROp cond);
+
+// calcule a op b avec la sémantique du code généré, pour op de ADD à GE.
+// Renvoie false si l'opération arrête le programme (division
+// par zéro ou quotient hors de 64 bits).
+bool eval_binop(IROp op, int64_t a, int64_t b, int64_t& res);
+
+// registres virtuels vivants en entrée et en sortie de chaque bloc,
+// sous forme d'ensembles triés
+struct Liveness{
+    vector<vector<int>> live_in, live_out;
+};
+
+Liveness compute_liveness(const IRFunction& func);
+
+// affiche l'IR sous forme textuelle, pour --dump-ir
+void print_ir(ostream& out, const IRModule& module);
+
+// construit les instructions d'une fonction, bloc par bloc
+class IRBuilder{
+    private :
+        IRFunction* m_func = nullptr;
+        int m_block = -1;
+    public :
+        IRModule& module;
+        IRBuilder(IRModule& module) : module(module) {}
+
+        IRFunction& func() { return *m_func; }
+        void set_function(IRFunction& func) { m_func = &func; }
+        int new_vreg() { return m_func->vregs_nb++; }
+        int new_block();
+        void set_block(int block) { m_block = block; }
+        int curr_block() const { return m_block; }
+        // le bloc courant se termine-t-il déjà par un saut ou un retour
+        bool terminated() const;
+
+        Instr& emit(IROp op, Value dst = {}, Value a = {}, Value b = {});
+        Value binop(IROp op, Value a, Value b);
+        void br(Value cond, int target, int target2);
+        void jmp(int target);
+};
+
+#endif
@@ -1,101 +1,207 @@
 #include "lexer.h"
+#include "thread_pool.h"
 
 #include <algorithm>
-#include <cwctype>
 #include <sstream>
-#include <cassert>
 #include <unordered_set>
 #include <cctype>
 #include <set>
 
-string op_hds = "!#$%&\'\"*+,-./:<=>?@\\^`{|}~";
+constexpr char op_hds[] = "!#$%&\'\"*+,-./:<=>?@\\^`{|}~";
 
-bool isnum(char c) {
+constexpr bool isnum(int c) {
     return c >= '0' && c <= '9';
 }
 
-DFA _LET(LET, "let");
-DFA _ID(ID, [](DFA* dfa) {
-    dfa->F = {0, 1};
-    dfa->transi.resize(2);
-    for (int c = 0; c < 255; c++) {
-        if (isalpha(c) || c == '_')
-            dfa->transi[0][c] = dfa->transi[1][c] = 1;
-        else if (isnum(c)) {
-            dfa->transi[1][c] = 1;
-            dfa->transi[0][c] = -1;
+constexpr bool is_id_hd(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+constexpr bool is_id_char(int c) {
+    return is_id_hd(c) || isnum(c);
+}
+
+constexpr bool is_op_hd(int c) {
+    for (const char* hd = op_hds; *hd; hd++)
+        if (*hd == c) return true;
+    return false;
+}
+
+constexpr bool is_op_char(int c) {
+    return is_op_hd(c) || is_id_char(c);
+}
+
+constexpr DFA::DFA(tokent tag, const char* str)
+    : tag(tag)
+{
+    for (; *str; str++, size++) {
+        for (int c = 0; c < 256; c++)
+            transi[size][c] = -1;
+        transi[size][(unsigned char)*str] = size+1;
+    }
+    for (int c = 0; c < 256; c++)
+        transi[size][c] = -1;
+    F[size++] = 1;
+}
+
+constexpr DFA::DFA(tokent tag, bool (*first)(int), bool (*next)(int))
+    : size(2), tag(tag)
+{
+    for (int c = 0; c < 256; c++) {
+        transi[0][c] = first(c) ? 1 : -1;
+        transi[1][c] = next(c) ? 1 : -1;
+    }
+    F[1] = 1;
+}
+
+// l'ordre donne la priorité en cas d'égalité de longueur : un mot clé l'emporte sur ID
+constexpr DFA pieces[] = {
+    {LET, "let"}, {EQUALS, "="}, {OPERATOR, "operator"}, {RETURN, "return"},
+    {LPAR, "("}, {RPAR, ")"}, {SEMICOL, ";"}, {IF, "if"}, {THEN, "then"},
+    {ELSE, "else"}, {LBRACKET, "["}, {RBRACKET, "]"},
+    {NUM, isnum, isnum}, {OPID, is_op_hd, is_op_char}, {ID, is_id_hd, is_id_char}
+};
+constexpr int pieces_nb = sizeof(pieces)/sizeof(pieces[0]);
+
+// Construction des sous-ensembles : chaque DFA étant déterministe, un
+// sous-ensemble d'états de leur union contient au plus un état par DFA.
+// On le code donc sur 4 bits par DFA, 0xF représentant l'état puits.
+static_assert(pieces_nb*4 <= 64, "too many DFA to encode a subset on 64 bits");
+
+constexpr int subset_state(uint64_t subset, int piece) {
+    int state = (subset >> (4*piece)) & 0xF;
+    return state == 0xF ? -1 : state;
+}
+
+constexpr LexTable<LEX_MAX_STATES> subset_construction() {
+    LexTable<LEX_MAX_STATES> res;
+    uint64_t subsets[LEX_MAX_STATES] = {};
+    const uint64_t dead = ~uint64_t(0);
+    for (int i = 0; i < pieces_nb; i++) {
+        if (pieces[i].size > 0xF) throw "DFA too large to be encoded on 4 bits";
+        subsets[0] &= ~(uint64_t(0xF) << (4*i));
+    }
+    subsets[0] |= dead << (4*pieces_nb);
+    res.size = 1;
+    for (int curr = 0; curr < res.size; curr++) {
+        // tag de l'état acceptant du DFA de plus haute priorité, comme NFA::output()
+        res.accept[curr] = -1;
+        for (int i = pieces_nb-1; i >= 0; i--) {
+            int state = subset_state(subsets[curr], i);
+            if (state != -1 && pieces[i].F[state])
+                res.accept[curr] = pieces[i].tag;
+        }
+        for (int c = 0; c < 256; c++) {
+            uint64_t next = dead;
+            for (int i = 0; i < pieces_nb; i++) {
+                int state = subset_state(subsets[curr], i);
+                if (state == -1 || pieces[i].transi[state][c] == -1) continue;
+                next &= ~(uint64_t(0xF) << (4*i));
+                next |= uint64_t(pieces[i].transi[state][c]) << (4*i);
+            }
+            if (next == dead) {
+                res.transi[curr][c] = -1;
+                continue;
+            }
+            int found = 0;
+            while (found < res.size && subsets[found] != next) found++;
+            if (found == res.size) {
+                if (res.size == LEX_MAX_STATES) throw "LEX_MAX_STATES is too small";
+                subsets[res.size++] = next;
+            }
+            res.transi[curr][c] = found;
         }
-        else
-            dfa->transi[0][c] = dfa->transi[1][c] = -1;
     }
-});
-DFA _EQUALS(EQUALS, "=");
-DFA _OPERATOR(OPERATOR, "operator");
-DFA _RETURN(RETURN, "return");
-DFA _OPID(OPID, [](DFA* dfa) {
-    dfa->F = {0, 1};
-    dfa->transi.resize(2);
-    for (int c = 0; c < 255; c++) {
-        dfa->transi[0][c] = dfa->transi[1][c] = -1;
-        if (op_hds.find(c) != string::npos)
-            dfa->transi[0][c] = dfa->transi[1][c] = 1;
-        if (isalnum(c) || c == '_')
-            dfa->transi[1][c] = 1;
+    return res;
+}
+
+// Minimisation de Moore : on raffine la partition selon le tag acceptant
+// jusqu'à ce que les classes soient stables par transition
+template <int N>
+constexpr LexTable<N> minimize(const LexTable<N>& dfa) {
+    int cls[N] = {}, new_cls[N] = {};
+    int cls_nb = 0;
+    for (int i = 0; i < dfa.size; i++) {
+        int j = 0;
+        while (j < i && dfa.accept[j] != dfa.accept[i]) j++;
+        cls[i] = j < i ? cls[j] : cls_nb++;
+    }
+    while (true) {
+        int new_nb = 0;
+        for (int i = 0; i < dfa.size; i++) {
+            int j = 0;
+            for (; j < i; j++) {
+                if (cls[j] != cls[i]) continue;
+                int c = 0;
+                for (; c < 256; c++) {
+                    int si = dfa.transi[i][c], sj = dfa.transi[j][c];
+                    if ((si == -1 ? -1 : cls[si]) != (sj == -1 ? -1 : cls[sj])) break;
+                }
+                if (c == 256) break;
+            }
+            new_cls[i] = j < i ? new_cls[j] : new_nb++;
+        }
+        for (int i = 0; i < dfa.size; i++)
+            cls[i] = new_cls[i];
+        if (new_nb == cls_nb) break;
+        cls_nb = new_nb;
     }
-});
-DFA _LPAR(LPAR, "(");
-DFA _RPAR(RPAR, ")");
-DFA _NUM(NUM, [](DFA* dfa) {
-    dfa->F = {0, 1};
-    dfa->transi.resize(2);
-    for (int c = 0; c < 255; c++)
-        dfa->transi[0][c] = dfa->transi[1][c] = isnum(c) ? 1 : -1;
-});
-DFA _SEMICOL(SEMICOL, ";");
-DFA _IF(IF, "if");
-DFA _THEN(THEN, "then");
-DFA _ELSE(ELSE, "else");
-DFA _LBRACKET(LBRACKET, "[");
-DFA _RBRACKET(RBRACKET, "]");
-
-NFA automata({_LET, _EQUALS, _OPERATOR, _RETURN, _LPAR,
-                _RPAR, _SEMICOL, _IF, _THEN, _ELSE,
-                _LBRACKET, _RBRACKET, _NUM, _OPID, _ID});
-
-Token::Token(tokent type, const char* lexeme) : type(type), lexeme(lexeme) {}
-
-template <typename T>
-maillon<T>::maillon(const T& val, const ConsList<T>& next)
-    : val(val), next(next) {}
-
-template <typename T>
-void ConsList<T>::push(const T& val) {
-    data = new maillon(val, *this);
+    // l'état initial garde le numéro 0 car cls[0] == 0
+    LexTable<N> res;
+    res.size = cls_nb;
+    for (int i = 0; i < dfa.size; i++) {
+        res.accept[cls[i]] = dfa.accept[i];
+        for (int c = 0; c < 256; c++)
+            res.transi[cls[i]][c] = dfa.transi[i][c] == -1 ? -1 : cls[dfa.transi[i][c]];
+    }
+    return res;
+}
+
+template <int N, int M>
+constexpr LexTable<N> shrink(const LexTable<M>& dfa) {
+    LexTable<N> res;
+    res.size = N;
+    for (int i = 0; i < N; i++) {
+        res.accept[i] = dfa.accept[i];
+        for (int c = 0; c < 256; c++)
+            res.transi[i][c] = dfa.transi[i][c];
+    }
+    return res;
 }
 
-template <typename T>
-T& ConsList<T>::front() {
-    assert(data);
-    return data->val;
+constexpr LexTable<LEX_MAX_STATES> lex_table_max = minimize(subset_construction());
+constexpr LexTable<lex_table_max.size> lex_table = shrink<lex_table_max.size>(lex_table_max);
+
+Token::Token(tokent type, string_view lexeme) : lexeme(lexeme), type(type) {}
+
+SymbolTable::SymbolTable()
+{
+    for (string_view name : {"+", "-", "*", "/", ":print", ":read", ":flush",
+                             ":memcpy", ":memset", ":memchr", ":memcmp", ":main",
+                             "==", "!=", "<", "<=", ">", ">=", "&&", "||", "!"})
+        intern(name);
 }
 
-template <typename T>
-ConsList<T>::~ConsList() {
-    if (data) delete data;
+int SymbolTable::intern(string_view name)
+{
+    // find avant insert : insert alloue un noeud même si le symbole existe
+    auto it = m_ids.find(name);
+    if (it != m_ids.end()) return it->second;
+    m_ids.emplace(name, (int)m_names.size());
+    m_names.push_back(name);
+    return m_names.size()-1;
 }
 
-// ConsList nécessaire (et pas vector) pour assurer
-// que les char* qui pointent vers un lexeme restent
-// valables
-ConsList<string> lexemes;
+SymbolTable symbols;
 
-vector<Token> lex(const string& input)
+vector<Token> lex(string_view input, SymbolTable& table, int first_line)
 {
     vector<Token> tokens;
-    int line = 1, col = 1;
-    int curr = 0, last_accept = -1, forward = -1;
+    int line = first_line, col = 1;
+    size_t curr = 0;
+    ptrdiff_t last_accept = -1;
     while (curr < input.size()) {
-        if (iswspace(input[curr])) {
+        if (isspace((unsigned char)input[curr])) {
             if (input[curr] == '\n') {
                 line++;
                 col = 1;
@@ -103,126 +209,83 @@ vector<Token> lex(const string& input)
             curr++;
             continue;
         }
-        forward = curr-1;
+        int state = 0;
         tokent tag;
-        while (!automata.is_blocked() && forward < (int)input.size()) {
-            forward++;
-            automata.next_state(input[forward]);
-            if (automata.est_acceptant()) {
+        for (size_t forward = curr; forward < input.size(); forward++) {
+            state = lex_table.transi[state][(unsigned char)input[forward]];
+            if (state == -1) break;
+            if (lex_table.accept[state] != -1) {
                 last_accept = forward;
-                tag = automata.output();
+                tag = (tokent)lex_table.accept[state];
             }
         }
-        if (last_accept < curr) {
+        if (last_accept < (ptrdiff_t)curr) {
             stringstream err_msg;
             err_msg << "lexeme at line " << line << ", column " << col << " is not recognized";
             throw LexicalError(err_msg.str());
         }
-        lexemes.push({input.begin()+curr, input.begin()+last_accept+1});
-        tokens.emplace_back(tag, lexemes.front().c_str());
+        tokens.emplace_back(tag, input.substr(curr, last_accept+1-curr));
         tokens.back().dbg_info = {.line = line, .col = col};
-        automata.reset();
-        col += lexemes.front().size();
+        if (tag == ID || tag == OPID)
+            tokens.back().sym = table.intern(tokens.back().lexeme);
+        col += tokens.back().lexeme.size();
         curr = last_accept+1;
     }
     return tokens;
 }
 
-DFA::DFA(tokent tag, function<void(DFA*)> constructor)
-    : tag(tag)
-{
-    constructor(this);
-}
+// taille minimale d'un morceau lexé par un thread
+#define LEX_CHUNK_SIZE (1 << 20)
 
-DFA::DFA(tokent tag, string str)
-    : tag(tag)
+vector<Token> lex(string_view input, ThreadPool& pool)
 {
-    if (!str.size()) return;
-    for (char c : str) {
-        F.push_back(0);
-        transi.push_back({});
-        for (int i = 0; i < 256; i++)
-            transi.back()[i] = -1;
-        transi.back()[c] = transi.size();
+    // aucun lexème ne contient de '\n' : on peut couper après n'importe lequel
+    int chunks_nb = min<size_t>(pool.size()*4, input.size()/LEX_CHUNK_SIZE + 1);
+    vector<string_view> chunks;
+    size_t start = 0;
+    for (int i = 1; i <= chunks_nb && start < input.size(); i++) {
+        size_t end = i == chunks_nb ? input.size() : input.size()/chunks_nb*i;
+        if (end < start) end = start;
+        end = input.find('\n', end);
+        end = end == string_view::npos ? input.size() : end+1;
+        chunks.push_back(input.substr(start, end-start));
+        start = end;
     }
-    F.push_back(1);
-    transi.push_back({});
-    for (int i = 0; i < 256; i++)
-        transi.back()[i] = -1;
-}
+    chunks_nb = chunks.size();
 
-NFA::NFA(const vector<DFA>& dfas)
-{
-    int offset = 1;
-    F.push_back(0);
-    transi.emplace_back();
-    for (const DFA& dfa : dfas) {
-        int n = dfa.F.size();
-        F.insert(F.end(), dfa.F.begin(), dfa.F.end());
-        transi.resize(transi.size()+n);
-        tag.resize(transi.size()+n);
-        for (int i = 0; i < n; i++) {
-            for (int c = 0; c < 256; c++) {
-                if (dfa.transi[i][c] != -1)
-                    transi[offset+i][c].insert(dfa.transi[i][c]+offset);
-            }
-            tag[offset+i] = dfa.tag;
-        }
-        transi[0][256].insert(offset);
-        offset += n;
-    }
-    reset();
-}
+    vector<int> first_lines(chunks_nb+1, 1);
+    pool.run(chunks_nb, [&](int i) {
+        first_lines[i+1] = count(chunks[i].begin(), chunks[i].end(), '\n');
+    });
+    for (int i = 0; i < chunks_nb; i++)
+        first_lines[i+1] += first_lines[i];
 
-void NFA::reset() {
-    unordered_set<int> init_states;
-    init_states.insert(0);
-    int size;
-    do {
-        size = init_states.size();
-        for (int state : init_states) {
-            for (int next : transi[state][256])
-                init_states.insert(next);
-        }
-    } while (size != init_states.size());
-    curr_states = init_states;
-}
+    // chaque morceau a sa propre table, dont les symboles du prelude ont
+    // les mêmes numéros que dans la table globale
+    vector<SymbolTable> tables(chunks_nb);
+    vector<vector<Token>> chunk_tokens(chunks_nb);
+    pool.run(chunks_nb, [&](int i) {
+        chunk_tokens[i] = lex(chunks[i], tables[i], first_lines[i]);
+    });
 
-void NFA::next_state(char c) {
-    unordered_set<int> new_states;
-    for (int state : curr_states) {
-        for (int next : transi[state][c])
-            new_states.insert(next);
+    // fusion dans l'ordre du fichier : les numéros des symboles sont les
+    // mêmes qu'avec un lexing séquentiel
+    vector<vector<int>> remaps(chunks_nb);
+    for (int i = 0; i < chunks_nb; i++) {
+        remaps[i].resize(tables[i].size());
+        for (int sym = 0; sym < tables[i].size(); sym++)
+            remaps[i][sym] = symbols.intern(tables[i].name(sym));
     }
-    int size;
-    do {
-        size = new_states.size();
-        for (int state : new_states) {
-            for (int next : transi[state][256])
-                new_states.insert(next);
-        }
-    } while (size != new_states.size());
-    curr_states = new_states;
-}
+    pool.run(chunks_nb, [&](int i) {
+        for (Token& tok : chunk_tokens[i])
+            if (tok.sym != -1) tok.sym = remaps[i][tok.sym];
+    });
 
-bool NFA::est_acceptant() {
-    for (int state : curr_states) {
-        if (F[state]) return true;
-    }
-    return false;
-}
-
-// précondition : est_acceptant() doit être vrai
-tokent NFA::output() {
-    int min_state = transi.size();
-    for (int state : curr_states) {
-        if (state < min_state && F[state])
-            min_state = state;
-    }
-    assert(min_state < transi.size() && "précondition non respecté : est_acceptant()");
-    return tag[min_state];
-}
-
-bool NFA::is_blocked() {
-    return !curr_states.size();
+    size_t total = 0;
+    for (auto& toks : chunk_tokens) total += toks.size();
+    vector<Token> tokens;
+    tokens.reserve(total);
+    for (auto& toks : chunk_tokens)
+        tokens.insert(tokens.end(), toks.begin(), toks.end());
+    return tokens;
 }
@@ -2,10 +2,12 @@
 #define LEXER_H
 
 #include <array>
+#include <cstdint>
 #include <cstddef>
 #include <functional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -35,57 +37,95 @@ enum tokent{
     OPID
 };
 
+// le lexème est une vue sur le texte source, qui doit donc rester
+// valable tant que le token est utilisé (cf SourceFile)
 struct Token{
+    string_view lexeme;
     tokent type;
-    const char* lexeme = 0;
+    // symbole interné pour ID et OPID, -1 sinon
+    int sym = -1;
     struct {
         int line = 0, col = 0;
     } dbg_info;
-    Token(tokent type, const char* lexeme = 0);
+    Token(tokent type, string_view lexeme = {});
 };
 
-vector<Token> lex(const string& input);
 
-template <typename T> struct maillon;
-template <typename T>
-class ConsList{
-    public :
-        maillon<T>* data = NULL;
-        void push(const T& val);
-        T& front();
-        ~ConsList();
+// symboles connus du compilateur, internés avant tous les autres
+enum preludeSym{
+    SYM_ADD,
+    SYM_SUB,
+    SYM_MUL,
+    SYM_DIV,
+    SYM_PRINT,
+    SYM_READ,
+    SYM_FLUSH,
+    // intrinsèques sur des plages du tape
+    SYM_MEMCPY,
+    SYM_MEMSET,
+    SYM_MEMCHR,
+    SYM_MEMCMP,
+    SYM_MAIN,
+    // comparaisons et logique, traduites directement par le compilateur
+    SYM_EQ,
+    SYM_NE,
+    SYM_LT,
+    SYM_LE,
+    SYM_GT,
+    SYM_GE,
+    SYM_AND,
+    SYM_OR,
+    SYM_NOT,
+    PRELUDE_SYM_NB
 };
 
-template <typename T>
-struct maillon{
-    T val;
-    ConsList<T> next = NULL;
-    maillon(const T& val, const ConsList<T>& next);
+// associe à chaque identifiant et opérateur un entier dense ; les noms sont
+// des vues sur le texte source, qui doit vivre aussi longtemps que la table
+class SymbolTable{
+    private :
+        unordered_map<string_view, int> m_ids;
+        vector<string_view> m_names;
+    public :
+        SymbolTable();
+        int intern(string_view name);
+        string_view name(int sym) const { return m_names[sym]; }
+        int size() const { return m_names.size(); }
 };
 
+extern SymbolTable symbols;
+
+class ThreadPool;
+
+// les symboles sont internés dans table, first_line est le numéro de la
+// première ligne de input dans le fichier
+vector<Token> lex(string_view input, SymbolTable& table = symbols, int first_line = 1);
+// découpe input en morceaux de lignes entières lexés en parallèle
+vector<Token> lex(string_view input, ThreadPool& pool);
+
+#define DFA_MAX_STATES 16
+#define LEX_MAX_STATES 64
+
+// petit automate déterministe reconnaissant une seule classe de lexèmes,
+// -1 représente l'état puits
 class DFA{
     public :
-        vector<array<int, 256>> transi;
-        vector<bool> F;
+        int16_t transi[DFA_MAX_STATES][256] = {};
+        bool F[DFA_MAX_STATES] = {};
+        int size = 0;
         tokent tag;
-        DFA(tokent type, string str);
-        DFA(tokent type, std::function<void(DFA*)> constructor);
+        constexpr DFA(tokent type, const char* str);
+        // lexèmes de la forme first next*
+        constexpr DFA(tokent type, bool (*first)(int), bool (*next)(int));
 };
 
-class NFA{
-    private :
-        // on choisi epsilon comme 257ème charactère
-        vector<array<unordered_set<int>, 257>> transi;
-        vector<bool> F;
-        vector<tokent> tag;
-        unordered_set<int> curr_states;
+// automate minimal reconnaissant l'union des DFA, calculé à la compilation
+template <int N>
+class LexTable{
     public :
-        NFA(const vector<DFA>& dfas);
-        void next_state(char c);
-        bool est_acceptant();
-        tokent output();
-        void reset();
-        bool is_blocked();
+        int16_t transi[N][256] = {};
+        // tag de l'état acceptant, -1 si l'état n'est pas acceptant
+        int8_t accept[N] = {};
+        int size = 0;
 };
 
 class LexicalError : public runtime_error {
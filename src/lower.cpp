@@ -0,0 +1,274 @@
+#include "codegen.h"
+#include "ast.h"
+
+#include <cassert>
+#include <charconv>
+#include <sstream>
+
+Value AST::lower(IRBuilder& ir, Environement& env) {
+    env.var_table.assign(symbols.size(), NO_VREG);
+    // tous les operators sont déclarés d'abord : un operator peut être
+    // utilisé avant sa définition
+    for (auto& op : ops)
+        op->declare(env);
+    ir.module.funcs.resize(env.ops_nb);
+    for (auto& op : ops)
+        op->lower(ir, env);
+    return {};
+}
+
+void OpDef::declare(Environement& env) {
+    Signature sign = {op.sym, (int)lhs_args.size(), (int)rhs_args.size()};
+    auto [_, success] = env.op_ids.insert({sign, env.ops_nb});
+    if (!success) {
+        stringstream error_msg;
+        error_msg << "operator \"" << op.lexeme << "\" is redefined here";
+        throw SemanticError(error_msg.str());
+    }
+    id = env.ops_nb++;
+}
+
+Value OpDef::lower(IRBuilder& ir, Environement& env) {
+    init_scope(env);
+    Signature sign = {op.sym, (int)lhs_args.size(), (int)rhs_args.size()};
+    const static Signature main_sign = {SYM_MAIN, 0, 0};
+    IRFunction& func = ir.module.funcs[id];
+    func.id = id;
+    func.sym = op.sym;
+    func.args_nb = lhs_args.size() + rhs_args.size();
+    func.is_main = sign == main_sign;
+    ir.set_function(func);
+    ir.set_block(ir.new_block());
+
+    int arg_nb = 0;
+    for (auto& arg : lhs_args) {
+        arg->vreg = ir.new_vreg();
+        arg->define_in_scope(env);
+        ir.emit(IROp::ARG, Value::vreg(arg->vreg), Value::imm(arg_nb++));
+    }
+    for (auto& arg : rhs_args) {
+        arg->vreg = ir.new_vreg();
+        arg->define_in_scope(env);
+        ir.emit(IROp::ARG, Value::vreg(arg->vreg), Value::imm(arg_nb++));
+    }
+
+    // la valeur d'un operator est celle de sa dernière instruction
+    Value res = Value::imm(0);
+    for (auto& statement : statements)
+        res = statement->lower(ir, env);
+    ir.emit(IROp::RET, {}, res);
+
+    del_scope(env);
+    return {};
+}
+
+void Scope::init_scope(Environement& env) {
+    env.curr_scope = this;
+}
+
+void Scope::del_scope(Environement& env) {
+    for (int i = 0; i < int_def_nb; i++) {
+        int& vreg = env.var_table[env.stack_frame.back()];
+        assert(vreg != NO_VREG);
+        vreg = NO_VREG;
+        env.stack_frame.pop_back();
+    }
+}
+
+void Var::define_in_scope(Environement& env) {
+    int& slot = env.var_table[id.sym];
+    if (slot != NO_VREG) {
+        stringstream err;
+        err << "identifier \"" << id.lexeme << "\" is redefined here";
+        throw SemanticError(err.str());
+    }
+    slot = vreg;
+    env.stack_frame.push_back(id.sym);
+    env.curr_scope->int_def_nb++;
+}
+
+static int lookup_var(const Token& id, Environement& env) {
+    int vreg = env.var_table[id.sym];
+    if (vreg == NO_VREG) {
+        stringstream err;
+        err << "identifier \"" << id.lexeme << "\" is used without being defined here";
+        throw SemanticError(err.str());
+    }
+    return vreg;
+}
+
+Value Var::lower(IRBuilder&, Environement& env) {
+    return Value::vreg(lookup_var(id, env));
+}
+
+void Var::lower_store(IRBuilder& ir, Environement& env, Value val) {
+    ir.emit(IROp::COPY, Value::vreg(lookup_var(id, env)), val);
+}
+
+Value Define::lower(IRBuilder& ir, Environement& env) {
+    Value val = expr->lower(ir, env);
+    lval->vreg = ir.new_vreg();
+    lval->define_in_scope(env);
+    ir.emit(IROp::COPY, Value::vreg(lval->vreg), val);
+    return Value::vreg(lval->vreg);
+}
+
+Value RvalToken::lower(IRBuilder&, Environement& env) {
+    if (id.type == NUM) {
+        long long val;
+        auto [_, ec] = from_chars(id.lexeme.data(), id.lexeme.data()+id.lexeme.size(), val);
+        if (ec != errc()) {
+            stringstream err;
+            err << "literal \"" << id.lexeme << "\" is too large";
+            throw SemanticError(err.str());
+        }
+        return Value::imm(val);
+    }
+    return Value::vreg(lookup_var(id, env));
+}
+
+Value RvalAccess::lower(IRBuilder& ir, Environement& env) {
+    Value addr = index->lower(ir, env);
+    Value dst = Value::vreg(ir.new_vreg());
+    ir.emit(IROp::LOAD, dst, addr).width = width;
+    return dst;
+}
+
+// instruction de l'opérateur binaire du prelude, COPY si sym n'en est pas un
+static IROp prelude_binop(int sym) {
+    switch (sym) {
+        case SYM_ADD: return IROp::ADD;
+        case SYM_SUB: return IROp::SUB;
+        case SYM_MUL: return IROp::MUL;
+        case SYM_DIV: return IROp::DIV;
+        case SYM_EQ: return IROp::EQ;
+        case SYM_NE: return IROp::NE;
+        case SYM_LT: return IROp::LT;
+        case SYM_LE: return IROp::LE;
+        case SYM_GT: return IROp::GT;
+        case SYM_GE: return IROp::GE;
+        // les opérandes valent 1 s'ils sont non nuls : voir OpApply::lower
+        case SYM_AND: return IROp::AND;
+        case SYM_OR: return IROp::OR;
+        default: return IROp::COPY;
+    }
+}
+
+Value OpApply::lower(IRBuilder& ir, Environement& env) {
+    Signature sign = {op.sym, (int)lhs.size(), (int)rhs.size()};
+    IROp binop = prelude_binop(op.sym);
+    if (sign.left_arity == 1 && sign.right_arity == 1 && binop != IROp::COPY) {
+        // l'opérande droit est évalué en premier
+        Value r = rhs[0]->lower(ir, env);
+        Value l = lhs[0]->lower(ir, env);
+        if (binop == IROp::AND)
+            return ir.binop(IROp::AND, ir.binop(IROp::NE, l, Value::imm(0)), ir.binop(IROp::NE, r, Value::imm(0)));
+        if (binop == IROp::OR)
+            return ir.binop(IROp::NE, ir.binop(IROp::OR, l, r), Value::imm(0));
+        return ir.binop(binop, l, r);
+    }
+    if (op.sym == SYM_NOT && sign.left_arity == 0 && sign.right_arity == 1)
+        return ir.binop(IROp::EQ, rhs[0]->lower(ir, env), Value::imm(0));
+    vector<Value> args;
+    for (auto& l_arg : lhs)
+        args.push_back(l_arg->lower(ir, env));
+    for (auto& r_arg : rhs)
+        args.push_back(r_arg->lower(ir, env));
+    Value dst = Value::vreg(ir.new_vreg());
+    if ((op.sym == SYM_PRINT || op.sym == SYM_READ)
+            && sign.left_arity == 0 && sign.right_arity == 2) {
+        ir.emit(op.sym == SYM_PRINT ? IROp::PRINT : IROp::READ, dst, args[0], args[1]);
+        return dst;
+    }
+    if (op.sym == SYM_FLUSH && sign.left_arity == 0 && sign.right_arity == 0) {
+        ir.emit(IROp::FLUSH, dst);
+        return dst;
+    }
+    if (op.sym >= SYM_MEMCPY && op.sym <= SYM_MEMCMP && sign.left_arity == 0 && sign.right_arity == 3) {
+        ir.emit((IROp)((int)IROp::MEMCPY + op.sym - SYM_MEMCPY), dst).args = std::move(args);
+        return dst;
+    }
+    auto it = env.op_ids.find(sign);
+    if (it == env.op_ids.end()) {
+        stringstream err;
+        err << "operator \"" << op.lexeme << "\" with these arguments is used without being defined here";
+        throw SemanticError(err.str());
+    }
+    Instr& call = ir.emit(IROp::CALL, dst);
+    call.callee = it->second;
+    call.args = std::move(args);
+    return dst;
+}
+
+Value Return::lower(IRBuilder& ir, Environement& env) {
+    return expr->lower(ir, env);
+}
+
+Value IfStatement::lower(IRBuilder& ir, Environement& env) {
+    Value cond_val = cond->lower(ir, env);
+    int cond_block = ir.curr_block();
+    Value res = Value::vreg(ir.new_vreg());
+
+    int block_true = ir.new_block();
+    ir.set_block(block_true);
+    Value val_true = expr_true->lower(ir, env);
+    int end_true = ir.curr_block();
+
+    int block_false = ir.new_block();
+    ir.set_block(block_false);
+    Value val_false = expr_false->lower(ir, env);
+    int end_false = ir.curr_block();
+
+    int join = ir.new_block();
+    ir.set_block(cond_block);
+    ir.br(cond_val, block_true, block_false);
+    ir.set_block(end_true);
+    ir.emit(IROp::COPY, res, val_true);
+    ir.jmp(join);
+    ir.set_block(end_false);
+    ir.emit(IROp::COPY, res, val_false);
+    ir.jmp(join);
+    ir.set_block(join);
+    return res;
+}
+
+Value LvalAccess::lower(IRBuilder& ir, Environement& env) {
+    return index->lower(ir, env);
+}
+
+void LvalAccess::lower_store(IRBuilder& ir, Environement& env, Value val) {
+    Value addr = index->lower(ir, env);
+    ir.emit(IROp::STORE, {}, addr, val).width = width;
+}
+
+int Var::size() { return 8; }
+int LvalAccess::size() { return width; }
+
+Value Assign::lower(IRBuilder& ir, Environement& env) {
+    Value val = expr->lower(ir, env);
+    lval->lower_store(ir, env, val);
+    return val;
+}
+
+Value FuncCall::lower(IRBuilder& ir, Environement& env) {
+    return expr->lower(ir, env);
+}
+
+template <class T>
+inline void hash_combine(std::size_t & s, const T & v)
+{
+  std::hash<T> h;
+  s^= h(v) + 0x9e3779b9 + (s<< 6) + (s>> 2);
+}
+
+size_t std::hash<Signature>::operator()(const Signature& sign) const {
+    size_t res = 0;
+    hash_combine(res, sign.sym);
+    hash_combine(res, sign.left_arity);
+    hash_combine(res, sign.right_arity);
+    return res;
+}
+
+bool Signature::operator==(const Signature& rhs) const {
+    return sym == rhs.sym && left_arity == rhs.left_arity && right_arity == rhs.right_arity;
+}
@@ -1,36 +1,236 @@
+#include "source.h"
 #include "lexer.h"
 #include "parser.h"
 #include "ast.h"
 #include "codegen.h"
+#include "bytecode.h"
+#include "passes.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
-#include <cassert>
 #include <iostream>
+#include <sys/resource.h>
+
+struct Options{
+    const char* input = nullptr;
+    // affiche la durée et le débit de chaque phase sur stderr
+    bool stats = false;
+    // construit le parseTree et l'affiche sur stderr avant de construire l'AST
+    bool dump_parse_tree = false;
+    // nombre de threads du front end, 0 pour un par coeur
+    int jobs = 0;
+    // affiche l'IR optimisée sur stderr
+    bool dump_ir = false;
+    // désactive les passes d'optimisation de l'IR
+    bool no_opt = false;
+    // mémoïse les opérateurs purs
+    bool memoize = false;
+    // :print et :read font chacun un appel système au lieu de passer par
+    // des tampons
+    bool unbuffered_io = false;
+    // écrit out.asm et l'assemble avec nasm et ld au lieu d'encoder
+    // directement l'exécutable
+    bool emit_asm = false;
+    // exécute le programme dans le processus du compilateur, dont le code
+    // de sortie est celui du programme, sans écrire d'exécutable
+    bool run = false;
+    // exécute le bytecode dans la machine virtuelle au lieu du code natif
+    bool vm = false;
+    // écrit le bytecode dans out.tbc au lieu d'un exécutable
+    bool emit_bytecode = false;
+    // taille et allocation du tape
+    TapeConfig tape;
+};
+
+// taille en octets, avec un suffixe K, M ou G éventuel, arrondie à des pages
+// entières ; -1 si invalide
+static int64_t parse_size(const char* str)
+{
+    char* end;
+    errno = 0;
+    long long size = strtoll(str, &end, 10);
+    int shift = 0;
+    if (*end == 'K') shift = 10;
+    else if (*end == 'M') shift = 20;
+    else if (*end == 'G') shift = 30;
+    if (shift) end++;
+    if (errno || end == str || *end || size <= 0 || size > MAX_TAPE_SIZE >> shift) return -1;
+    return (((int64_t)size << shift) + TAPE_PAGE_SIZE-1) / TAPE_PAGE_SIZE * TAPE_PAGE_SIZE;
+}
+
+static Options parse_args(int argc, char** argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--stats")) opts.stats = true;
+        else if (!strcmp(argv[i], "--dump-parse-tree")) opts.dump_parse_tree = true;
+        else if (!strcmp(argv[i], "-j") && i+1 < argc) opts.jobs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--dump-ir")) opts.dump_ir = true;
+        else if (!strcmp(argv[i], "-O0")) opts.no_opt = true;
+        else if (!strcmp(argv[i], "--memoize")) opts.memoize = true;
+        else if (!strcmp(argv[i], "--unbuffered-io")) opts.unbuffered_io = true;
+        else if (!strcmp(argv[i], "--emit-asm")) opts.emit_asm = true;
+        else if (!strcmp(argv[i], "--run")) opts.run = true;
+        else if (!strcmp(argv[i], "--vm")) opts.vm = true;
+        else if (!strcmp(argv[i], "--emit-bytecode")) opts.emit_bytecode = true;
+        else if (!strcmp(argv[i], "--tape-size") && i+1 < argc) {
+            opts.tape.size = parse_size(argv[++i]);
+            if (opts.tape.size < 0) {
+                cerr << "invalid tape size " << argv[i] << ", at most " << (MAX_TAPE_SIZE >> 30) << "G\n";
+                exit(2);
+            }
+        }
+        else if (!strcmp(argv[i], "--tape-populate")) opts.tape.populate = true;
+        else if (!strcmp(argv[i], "--tape-huge-pages")) opts.tape.huge_pages = true;
+        else if (argv[i][0] == '-' && argv[i][1]) {
+            cerr << "unknown option " << argv[i] << '\n';
+            exit(2);
+        }
+        else opts.input = argv[i];
+    }
+    if (!opts.input) {
+        cerr << "usage: " << argv[0] << " [--stats] [--dump-parse-tree] [--dump-ir] [-O0] [--memoize] [--unbuffered-io]\n"
+             << "       [--tape-size bytes[K|M|G]] [--tape-populate] [--tape-huge-pages]\n"
+             << "       [--emit-asm | --run | --vm | --emit-bytecode] [-j jobs] file.tipe\n"
+             << "       " << argv[0] << " [--unbuffered-io] file.tbc\n";
+        exit(2);
+    }
+    return opts;
+}
+
+class PhaseTimer{
+    using clock = chrono::steady_clock;
+    bool m_enabled;
+    clock::time_point m_start = clock::now();
+public :
+    PhaseTimer(bool enabled) : m_enabled(enabled) {}
+
+    // affiche la durée écoulée depuis le dernier appel, et le débit si items > 0
+    void lap(const char* phase, size_t items = 0) {
+        clock::time_point now = clock::now();
+        double secs = chrono::duration<double>(now - m_start).count();
+        m_start = now;
+        if (!m_enabled) return;
+        cerr << phase << ": " << secs*1e3 << " ms";
+        if (items) cerr << " (" << (size_t)(items/secs) << " tokens/s)";
+        cerr << '\n';
+    }
+};
+
+static void print_peak_rss()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    cerr << "peak RSS: " << usage.ru_maxrss << " KB\n";
+}
 
 int main(int argc, char** argv)
 {
-    assert(argc == 2);
+    Options opts = parse_args(argc, argv);
+    PhaseTimer timer{opts.stats};
+
+    // un bytecode enregistré par --emit-bytecode est exécuté directement
+    size_t input_len = strlen(opts.input);
+    if (input_len > 4 && !strcmp(opts.input + input_len - 4, ".tbc"))
+        return run_bytecode(read_bytecode(opts.input), !opts.unbuffered_io) & 0xFF;
 
-    ifstream file{argv[1]};
-    file.seekg(0, ios::end);
-    size_t size = file.tellg();
-    file.seekg(0, ios::beg);
-    string input(size,0);
-    file.read(&input[0], size);
-    file.close();
+    int jobs = opts.jobs > 0 ? opts.jobs : max(1u, thread::hardware_concurrency());
+    if (opts.dump_parse_tree) jobs = 1;
+    ThreadPool pool{jobs};
 
-    vector<Token> tokens = lex(input);
-    parseTree tree = parse(tokens);
-    AST ast = toAST(tree);
+    // les noms de la table des symboles pointent dans le source
+    SourceFile source{opts.input};
+    // le front end est libéré dès que l'IR est construite : la suite
+    // n'a plus besoin des tokens ni de l'AST
+    IRModule module = [&] {
+        vector<Token> tokens = jobs > 1 ? lex(source.text(), pool) : lex(source.text());
+        timer.lap("lex", tokens.size());
+        AST ast = [&] {
+            if (jobs > 1)
+                return parseAST(tokens, pool);
+            if (!opts.dump_parse_tree)
+                return parseAST(tokens);
+            parseTree tree = parse(tokens);
+            dump(cerr, tree);
+            return toAST(tree);
+        }();
+        timer.lap("parse", tokens.size());
+        vector<Token>().swap(tokens);
+        if (opts.stats)
+            cerr << "ast: " << ast.arena.objects_nb() << " nodes, "
+                 << ast.arena.bytes_used()/1024 << " KB used in "
+                 << ast.arena.chunks_nb() << " chunks\n";
 
-    Environement env;
-    ofstream out{"out.asm"};
-    ast.codegen(out, env);
-    out.close();
+        Environement env;
+        IRModule module;
+        module.tape = opts.tape;
+        IRBuilder ir{module};
+        ast.lower(ir, env);
+        timer.lap("lower");
+        return module;
+    }();
+    if (!opts.no_opt) {
+        PassManager passes;
+        add_default_passes(passes);
+        passes.run(module);
+        timer.lap("optimize");
+        if (opts.stats) passes.print_stats(cerr);
+    }
+    if (opts.memoize) {
+        int memoized = memoize_pure_functions(module);
+        timer.lap("memoize");
+        if (opts.stats)
+            cerr << "memoized: " << memoized << " operators, "
+                 << module.memo_size/1024 << " KB of tables\n";
+    }
+    if (opts.dump_ir) print_ir(cerr, module);
+    int64_t exit_code = 0;
+    if (opts.vm || opts.emit_bytecode) {
+        Bytecode bc = compile_bytecode(module);
+        module = {};
+        timer.lap("bytecode");
+        if (opts.emit_bytecode)
+            write_bytecode("out.tbc", bc);
+        else {
+            exit_code = run_bytecode(bc, !opts.unbuffered_io);
+            timer.lap("run");
+        }
+        if (opts.stats) print_peak_rss();
+        return exit_code & 0xFF;
+    }
+    MProgram prog = codegen(std::move(module), opts.run, !opts.unbuffered_io);
+    timer.lap("codegen");
+    if (opts.run) {
+        MachineCode code = encode(prog);
+        vector<MInstr>().swap(prog.code);
+        timer.lap("encode");
+        exit_code = run_jit(code);
+        timer.lap("run");
+    } else if (opts.emit_asm) {
+        ofstream out{"out.asm"};
+        print_nasm(out, prog);
+        out.close();
+        if (!out) throw IOError("cannot write \"out.asm\"");
+        timer.lap("emit");
+        // comme write_elf, un échec de l'assembleur ou de l'éditeur de liens
+        // est une erreur d'entrée-sortie
+        if (system("nasm -felf64 out.asm") != 0) throw IOError("nasm failed on \"out.asm\"");
+        if (system("ld out.o") != 0) throw IOError("ld failed on \"out.o\"");
+    } else {
+        MachineCode code = encode(prog);
+        vector<MInstr>().swap(prog.code);
+        timer.lap("encode");
+        write_elf("a.out", code);
+        timer.lap("emit");
+    }
 
-    system("nasm -felf64 out.asm");
-    system("ld out.o");
+    if (opts.stats) print_peak_rss();
 
-    return 0;
+    // comme pour l'appel système exit, seul l'octet de poids faible compte
+    return exit_code & 0xFF;
 }
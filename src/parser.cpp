@@ -1,5 +1,9 @@
 #include "parser.h"
 #include "lexer.h"
+#include "ast.h"
+#include "thread_pool.h"
+
+#include <algorithm>
 
 SyntaxError::SyntaxError(const char* str, optional<parseNode> expected)
     : runtime_error::runtime_error(str), expected(expected) {}
@@ -12,46 +16,25 @@ parseNode::parseNode(Token tok)
 parseTree::parseTree(parseNode root, vector<parseTree>&& childs)
     : root(root), childs(std::move(childs)) {}
 
-class TokenOpt : public optional<Token> {
-public:
-    using optional<Token>::optional;
-    bool operator==(tokent tt) {
-        return has_value() && value().type == tt;
-    }
-    bool operator!=(tokent tt) { return !(operator==(tt)); }
-};
-
-class TokenStream{
-    const vector<Token>& m_tokens;
-    int m_index;
-public :
-    TokenStream(const vector<Token>& tok)
-        : m_tokens(tok), m_index(0) {}
-
-    TokenStream& operator>>(TokenOpt& t) {
-        if (m_index >= m_tokens.size()) t = nullopt;
-        else t = m_tokens[m_index];
-        m_index++;
-        return *this;
-    }
+// FIRST(EXPR) : le parser n'a besoin que d'un token de lookahead
+static bool starts_EXPR(TokenOpt tok) {
+    return tok == NUM || tok == ID || tok == LPAR || tok == IF || tok == LBRACKET;
+}
 
-    operator bool(){
-        return m_index <= m_tokens.size();
-    }
+// largeur en octets d'un accès au tape, écrite avant le "]"
+static bool is_access_width(TokenOpt tok) {
+    if (tok != NUM) return false;
+    string_view w = tok.value().lexeme;
+    return w == "1" || w == "2" || w == "4" || w == "8";
+}
 
-    void go_back() {
-        m_index--;
-    }
-
-    bool ended() {
-        return m_index >= m_tokens.size();
-    }
-};
+static const char* const access_width_error = "expected an access width of 1, 2, 4 or 8 here";
 
 #define DEF_PARSE_NONTERM(V) \
 parseTree parse_##V(TokenStream& stream)
 DEF_PARSE_NONTERM(START); DEF_PARSE_NONTERM(OP_BLOCK); DEF_PARSE_NONTERM(ID_LIST); DEF_PARSE_NONTERM(STAT_LIST);
-DEF_PARSE_NONTERM(STATEMENT); DEF_PARSE_NONTERM(EXPR); DEF_PARSE_NONTERM(EXPR_LIST); DEF_PARSE_NONTERM(ACCESS);
+DEF_PARSE_NONTERM(STATEMENT); DEF_PARSE_NONTERM(EXPR); DEF_PARSE_NONTERM(EXPR_LIST);
+parseTree parse_ACCESS(TokenStream& stream, const Token& lbracket);
 
 parseTree parse(const vector<Token>& tokens)
 {
@@ -67,35 +50,35 @@ auto make_vec(Args&&... args) {
     return vec;
 }
 
+// les listes sont construites itérativement : leurs éléments sont les
+// enfants directs du noeud, pour ne pas récurser une fois par élément
+
 parseTree parse_START(TokenStream& stream)
 {
-    TokenOpt t;
-    if (stream.ended())
-        return parseTree{parseNode{START}};
-    parseTree op_block = parse_OP_BLOCK(stream);
-    auto childs = make_vec<parseTree>(std::move(op_block), parse_START(stream));
-    return parseTree{parseNode{START}, std::move(childs)};
+    parseTree res = {parseNode{START}};
+    while (!stream.ended())
+        res.childs.push_back(parse_OP_BLOCK(stream));
+    return res;
 }
 
 // todo : better way to "expect & raise error or add to tree"
 
 parseTree parse_OP_BLOCK(TokenStream& stream)
 {
-    TokenOpt t;
-    stream >> t;
+    TokenOpt t = stream.next();
     // gestion d'erreurs reste à améliorer pour inclure le numéro de ligne ... here à préciser
     if (t != OPERATOR) throw SyntaxError("expected \"operator\" keyword here", Token{OPERATOR});
     parseTree res = {parseNode{OP_BLOCK}};
     res.add_token(t.value());
-    stream >> t;
+    t = stream.next();
     if (t != LPAR) throw SyntaxError("expected \"(\" here", Token{LPAR});
     res.add_token(t.value());
     res.childs.push_back(parse_ID_LIST(stream));
-    stream >> t;
+    t = stream.next();
     if (t != OPID) throw SyntaxError("expected an operator here", Token{OPID});
     res.add_token(t.value());
     res.childs.push_back(parse_ID_LIST(stream));
-    stream >> t;
+    t = stream.next();
     if (t != RPAR) throw SyntaxError("expected \")\" here", Token{RPAR});
     res.add_token(t.value());
     res.childs.push_back(parse_STAT_LIST(stream));
@@ -103,103 +86,94 @@ parseTree parse_OP_BLOCK(TokenStream& stream)
 }
 
 parseTree parse_ID_LIST(TokenStream& stream) {
-    TokenOpt tok;
-    stream >> tok;
-    if (tok == ID)
-        return {{ID_LIST}, make_vec<parseTree>( parseTree{{tok.value()}}, parse_ID_LIST(stream) )};
-    stream.go_back();
-    return {{ID_LIST}};
+    parseTree res = {{ID_LIST}};
+    while (stream.peek() == ID)
+        res.add_token(stream.next().value());
+    return res;
 }
 
 parseTree parse_STAT_LIST(TokenStream& stream) {
-    TokenOpt tok;
-    stream >> tok;
-    stream.go_back();
-    if (tok != OPERATOR && tok.has_value()) {
-        parseTree statement = parse_STATEMENT(stream);
-        return {{STAT_LIST}, make_vec<parseTree>(std::move(statement), parse_STAT_LIST(stream))};
-    } else
-        return {{STAT_LIST}};
-};
+    parseTree res = {{STAT_LIST}};
+    while (!stream.ended() && stream.peek() != OPERATOR)
+        res.childs.push_back(parse_STATEMENT(stream));
+    return res;
+}
 
 // précondition : !stream.ended()
 parseTree parse_STATEMENT(TokenStream& stream) {
     parseTree res = {{STATEMENT}};
-    TokenOpt tok;
-    stream >> tok;
-    if (tok != LET && tok != RETURN && tok != ID)
-        stream.go_back();
-    else
-        res.add_token(tok.value());
+    TokenOpt tok = stream.peek(), first = tok;
+    if (tok == LET || tok == RETURN || tok == ID)
+        res.add_token(stream.next().value());
     if (tok == LBRACKET)
-        res.childs.push_back(parse_ACCESS(stream));
+        res.childs.push_back(parse_ACCESS(stream, stream.next().value()));
     if (tok == LET) {
-        stream >> tok;
+        tok = stream.next();
         if (tok != ID) throw SyntaxError("expected variable name here", Token{ID});
         res.add_token(tok.value());
     }
-    TokenOpt old_tok = tok;
     if (tok == LET || tok == ID || tok == LBRACKET) {
-        stream >> tok;
-        if ((old_tok == LBRACKET || old_tok == ID) && tok == SEMICOL)
+        tok = stream.next();
+        if ((first == LBRACKET || first == ID) && tok == SEMICOL)
             return {{STATEMENT}, make_vec<parseTree>(parseTree{{EXPR}, std::move(res.childs)}, parseTree{{SEMICOL}})};
         if (tok != EQUALS) throw SyntaxError("expected \"=\" here", Token{EQUALS});
         res.add_token(tok.value());
     }
 
     res.childs.push_back(parse_EXPR(stream));
-    stream >> tok;
+    tok = stream.next();
     if (tok != SEMICOL) throw SyntaxError("expected \";\" here", Token{SEMICOL});
     res.add_token(tok.value());
     return res;
 }
 
 parseTree parse_EXPR(TokenStream& stream) {
-    TokenOpt tok;
-    stream >> tok;
+    TokenOpt tok = stream.next();
     parseTree res = {{EXPR}};
     if (tok == NUM || tok == ID)
         return {{EXPR}, make_vec<parseTree>(parseTree{{tok.value()}})};
     else if (tok == LPAR) {
         res.add_token(tok.value());
         res.childs.push_back(parse_EXPR_LIST(stream));
-        stream >> tok;
+        tok = stream.next();
         if (tok != OPID) throw SyntaxError("expected an operator here", Token{OPID});
         res.add_token(tok.value());
         res.childs.push_back(parse_EXPR_LIST(stream));
-        stream >> tok;
+        tok = stream.next();
         if (tok != RPAR) throw SyntaxError("expected \")\" here", Token{RPAR});
         res.add_token(tok.value());
         return res;
     } else if (tok == IF) {
         res.add_token(tok.value());
         res.childs.push_back(parse_EXPR(stream));
-        stream >> tok;
+        tok = stream.next();
         if (tok != THEN) throw SyntaxError("expected \"then\" here", Token{THEN});
         res.add_token(tok.value());
         res.childs.push_back(parse_EXPR(stream));
-        stream >> tok;
+        tok = stream.next();
         if (tok != ELSE) throw SyntaxError("expected \"else\" here", Token{ELSE});
         res.add_token(tok.value());
         res.childs.push_back(parse_EXPR(stream));
         return res;
     } else if (tok == LBRACKET) {
-        stream.go_back();
-        res.childs.push_back(parse_ACCESS(stream));
+        res.childs.push_back(parse_ACCESS(stream, tok.value()));
         return res;
     } else
         throw SyntaxError("expected an expression here", nonTerm{EXPR});
 }
 
-parseTree parse_ACCESS(TokenStream& stream) {
+// lbracket : le "[" déjà consommé par l'appelant
+parseTree parse_ACCESS(TokenStream& stream, const Token& lbracket) {
     TokenOpt token;
-    stream >> token;
-    if (token != LBRACKET)
-        throw SyntaxError("expected \"[\" here", Token{LBRACKET});
     parseTree res{ACCESS};
-    res.add_token(token.value());
+    res.add_token(lbracket);
     res.childs.push_back(parse_EXPR(stream));
-    stream >> token;
+    token = stream.next();
+    if (token == NUM) {
+        if (!is_access_width(token)) throw SyntaxError(access_width_error, Token{NUM});
+        res.add_token(token.value());
+        token = stream.next();
+    }
     if (token != RBRACKET)
         throw SyntaxError("expected \"]\" here", Token{RBRACKET});
     res.add_token(token.value());
@@ -207,14 +181,213 @@ parseTree parse_ACCESS(TokenStream& stream) {
 }
 
 parseTree parse_EXPR_LIST(TokenStream& stream) {
-    try {
-        parseTree expr = parse_EXPR(stream);
-        return {{EXPR_LIST}, make_vec<parseTree>(std::move(expr), parse_EXPR_LIST(stream))};
-    } catch (const SyntaxError& e) {
-        if (e.expected.has_value() && e.expected->tag == parseNode::NONTERM && e.expected->val.nt == EXPR) {
-            stream.go_back();
-            return {{EXPR_LIST}};
+    parseTree res = {{EXPR_LIST}};
+    while (starts_EXPR(stream.peek()))
+        res.childs.push_back(parse_EXPR(stream));
+    return res;
+}
+
+static const char* const nonTerm_names[] = {
+    "START", "OP_BLOCK", "ID_LIST", "STAT_LIST", "STATEMENT", "EXPR", "EXPR_LIST", "ACCESS"
+};
+
+static const char* const tokent_names[] = {
+    "LET", "IF", "THEN", "ELSE", "RETURN", "OPERATOR", "SEMICOL", "EQUALS",
+    "LPAR", "RPAR", "LBRACKET", "RBRACKET", "NUM", "ID", "OPID"
+};
+
+void dump(ostream& out, const parseTree& tree, int depth)
+{
+    for (int i = 0; i < depth; i++) out << "  ";
+    if (tree.root.tag == parseNode::NONTERM)
+        out << nonTerm_names[tree.root.val.nt] << '\n';
+    else
+        out << tokent_names[tree.root.val.tok.type] << " \"" << tree.root.val.tok.lexeme << "\"\n";
+    for (const parseTree& child : tree.childs)
+        dump(out, child, depth+1);
+}
+
+// Parser construisant directement l'AST, sans passer par le parseTree.
+// Il reconnaît le même langage et lève les mêmes erreurs que parse_*.
+// Les éléments des listes en cours de construction sont empilés dans des
+// piles partagées puis copiés d'un bloc dans l'arène.
+struct ASTParser{
+    TokenStream stream;
+    Arena& arena;
+    vector<Expr*> exprs;
+    vector<Var*> vars;
+    vector<Statement*> statements;
+
+    OpDef* parse_OpDef();
+    Statement* parse_Statement();
+    Expr* parse_Expr();
+    int parse_Width();
+    Span<Var*> parse_Vars();
+    Span<Expr*> parse_Exprs();
+    void expect(tokent type, const char* err_msg);
+};
+
+AST parseAST(const vector<Token>& tokens)
+{
+    Arena arena;
+    ASTParser parser = {{tokens}, arena};
+    vector<OpDef*> ops;
+    while (!parser.stream.ended())
+        ops.push_back(parser.parse_OpDef());
+    Span<OpDef*> ops_span = arena.copy(ops.begin(), ops.end());
+    return {std::move(arena), ops_span};
+}
+
+// nombre minimal de tokens parsés par un thread
+#define PARSE_CHUNK_SIZE (1 << 16)
+
+AST parseAST(const vector<Token>& tokens, ThreadPool& pool)
+{
+    // chaque bloc "operator" se parse indépendamment des autres : on coupe
+    // juste avant un token OPERATOR, le premier morceau commençant à 0
+    // pour que les erreurs de syntaxe soient les mêmes qu'en séquentiel
+    int ranges_nb = min<size_t>(pool.size()*4, tokens.size()/PARSE_CHUNK_SIZE + 1);
+    vector<size_t> bounds = {0};
+    for (int i = 1; i < ranges_nb; i++) {
+        size_t cut = max(bounds.back()+1, tokens.size()/ranges_nb*i);
+        while (cut < tokens.size() && tokens[cut].type != OPERATOR) cut++;
+        if (cut >= tokens.size()) break;
+        bounds.push_back(cut);
+    }
+    bounds.push_back(tokens.size());
+    ranges_nb = bounds.size()-1;
+
+    vector<Arena> arenas(ranges_nb);
+    vector<vector<OpDef*>> ops(ranges_nb);
+    pool.run(ranges_nb, [&](int i) {
+        ASTParser parser = {{tokens.data()+bounds[i], tokens.data()+bounds[i+1]}, arenas[i]};
+        while (!parser.stream.ended())
+            ops[i].push_back(parser.parse_OpDef());
+    });
+
+    Arena arena;
+    vector<OpDef*> all_ops;
+    for (int i = 0; i < ranges_nb; i++) {
+        arena.absorb(std::move(arenas[i]));
+        all_ops.insert(all_ops.end(), ops[i].begin(), ops[i].end());
+    }
+    Span<OpDef*> ops_span = arena.copy(all_ops.begin(), all_ops.end());
+    return {std::move(arena), ops_span};
+}
+
+Span<Var*> ASTParser::parse_Vars() {
+    size_t mark = vars.size();
+    while (stream.peek() == ID)
+        vars.push_back(arena.make<Var>(stream.next().value()));
+    Span<Var*> res = arena.copy(vars.begin()+mark, vars.end());
+    vars.resize(mark);
+    return res;
+}
+
+Span<Expr*> ASTParser::parse_Exprs() {
+    size_t mark = exprs.size();
+    while (starts_EXPR(stream.peek())) {
+        Expr* expr = parse_Expr();
+        exprs.push_back(expr);
+    }
+    Span<Expr*> res = arena.copy(exprs.begin()+mark, exprs.end());
+    exprs.resize(mark);
+    return res;
+}
+
+void ASTParser::expect(tokent type, const char* err_msg) {
+    if (stream.next() != type) throw SyntaxError(err_msg, Token{type});
+}
+
+OpDef* ASTParser::parse_OpDef()
+{
+    expect(OPERATOR, "expected \"operator\" keyword here");
+    expect(LPAR, "expected \"(\" here");
+    Span<Var*> lhs_args = parse_Vars();
+    TokenOpt op = stream.next();
+    if (op != OPID) throw SyntaxError("expected an operator here", Token{OPID});
+    Span<Var*> rhs_args = parse_Vars();
+    expect(RPAR, "expected \")\" here");
+    size_t mark = statements.size();
+    while (!stream.ended() && stream.peek() != OPERATOR)
+        statements.push_back(parse_Statement());
+    Span<Statement*> body = arena.copy(statements.begin()+mark, statements.end());
+    statements.resize(mark);
+    return arena.make<OpDef>(op.value(), lhs_args, rhs_args, body);
+}
+
+// précondition : !stream.ended()
+Statement* ASTParser::parse_Statement() {
+    TokenOpt tok = stream.peek();
+    Statement* res;
+    if (tok == LET) {
+        stream.next();
+        TokenOpt id = stream.next();
+        if (id != ID) throw SyntaxError("expected variable name here", Token{ID});
+        expect(EQUALS, "expected \"=\" here");
+        Var* var = arena.make<Var>(id.value());
+        res = arena.make<Define>(var, parse_Expr());
+    } else if (tok == RETURN) {
+        stream.next();
+        res = arena.make<Return>(parse_Expr());
+    } else if (tok == ID || tok == LBRACKET) {
+        stream.next();
+        Expr* index = nullptr;
+        int width = 1;
+        if (tok == LBRACKET) {
+            index = parse_Expr();
+            width = parse_Width();
+        }
+        TokenOpt next = stream.next();
+        if (next == SEMICOL) {
+            if (tok == ID) return arena.make<FuncCall>(arena.make<RvalToken>(tok.value()));
+            return arena.make<FuncCall>(arena.make<RvalAccess>(index, width));
         }
-        else throw e;
+        if (next != EQUALS) throw SyntaxError("expected \"=\" here", Token{EQUALS});
+        Lvalue* lval;
+        if (tok == ID) lval = arena.make<Var>(tok.value());
+        else lval = arena.make<LvalAccess>(index, width);
+        res = arena.make<Assign>(lval, parse_Expr());
+    } else
+        res = arena.make<FuncCall>(parse_Expr());
+    expect(SEMICOL, "expected \";\" here");
+    return res;
+}
+
+// fin d'un accès au tape : largeur éventuelle puis "]"
+int ASTParser::parse_Width() {
+    int width = 1;
+    if (stream.peek() == NUM) {
+        TokenOpt tok = stream.next();
+        if (!is_access_width(tok)) throw SyntaxError(access_width_error, Token{NUM});
+        width = tok.value().lexeme[0] - '0';
     }
+    expect(RBRACKET, "expected \"]\" here");
+    return width;
+}
+
+Expr* ASTParser::parse_Expr() {
+    TokenOpt tok = stream.next();
+    if (tok == NUM || tok == ID)
+        return arena.make<RvalToken>(tok.value());
+    else if (tok == LPAR) {
+        Span<Expr*> lhs = parse_Exprs();
+        TokenOpt op = stream.next();
+        if (op != OPID) throw SyntaxError("expected an operator here", Token{OPID});
+        Span<Expr*> rhs = parse_Exprs();
+        expect(RPAR, "expected \")\" here");
+        return arena.make<OpApply>(op.value(), lhs, rhs);
+    } else if (tok == IF) {
+        Expr* cond = parse_Expr();
+        expect(THEN, "expected \"then\" here");
+        Expr* expr_true = parse_Expr();
+        expect(ELSE, "expected \"else\" here");
+        Expr* expr_false = parse_Expr();
+        return arena.make<IfStatement>(cond, expr_true, expr_false);
+    } else if (tok == LBRACKET) {
+        Expr* index = parse_Expr();
+        int width = parse_Width();
+        return arena.make<RvalAccess>(index, width);
+    } else
+        throw SyntaxError("expected an expression here", nonTerm{EXPR});
 }
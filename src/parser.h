@@ -3,6 +3,8 @@
 
 #include "lexer.h"
 #include <memory>
+#include <optional>
+#include <ostream>
 #include <unordered_map>
 #include <string>
 
@@ -52,6 +54,44 @@ class SyntaxError : public std::runtime_error{
         SyntaxError(const char* str, optional<parseNode> expected = nullopt);
 };
 
+class TokenOpt : public optional<Token> {
+public:
+    using optional<Token>::optional;
+    bool operator==(tokent tt) {
+        return has_value() && value().type == tt;
+    }
+    bool operator!=(tokent tt) { return !(operator==(tt)); }
+};
+
+class TokenStream{
+    const Token* m_curr;
+    const Token* m_end;
+public :
+    TokenStream(const Token* first, const Token* last)
+        : m_curr(first), m_end(last) {}
+    TokenStream(const vector<Token>& tok)
+        : TokenStream(tok.data(), tok.data()+tok.size()) {}
+
+    // prochain token, sans le consommer
+    TokenOpt peek() const {
+        if (m_curr == m_end) return nullopt;
+        return *m_curr;
+    }
+
+    TokenOpt next() {
+        TokenOpt t = peek();
+        if (t.has_value()) m_curr++;
+        return t;
+    }
+
+    bool ended() const {
+        return m_curr == m_end;
+    }
+};
+
 parseTree parse(const vector<Token>& tokens);
 
+// affichage indenté de l'arbre, pour le débogage
+void dump(ostream& out, const parseTree& tree, int depth = 0);
+
 #endif
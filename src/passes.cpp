@@ -0,0 +1,944 @@
+#include "passes.h"
+
+#include <algorithm>
+
+// ordre postfixe du graphe d'appel : une fonction est optimisée après
+// celles qu'elle appelle, qui sont ainsi déjà réduites quand on les intègre
+static vector<int> callees_first(const IRModule& module) {
+    int n = module.funcs.size();
+    vector<int> order;
+    vector<char> state(n, 0);
+    // pile explicite de (fonction, appels déjà empilés)
+    vector<pair<int, bool>> stack;
+    for (int root = 0; root < n; root++) {
+        if (state[root]) continue;
+        stack.push_back({root, false});
+        while (!stack.empty()) {
+            auto [f, expanded] = stack.back();
+            stack.pop_back();
+            if (expanded) {
+                order.push_back(f);
+                continue;
+            }
+            if (state[f]) continue;
+            state[f] = 1;
+            stack.push_back({f, true});
+            for (const BasicBlock& block : module.funcs[f].blocks)
+                for (const Instr& instr : block.instrs)
+                    if (instr.callee != -1 && !state[instr.callee])
+                        stack.push_back({instr.callee, false});
+        }
+    }
+    return order;
+}
+
+void PassManager::run(IRModule& module) {
+    for (int f : callees_first(module)) {
+        IRFunction& func = module.funcs[f];
+        bool changed = true;
+        for (int round = 0; changed && round < max_rounds; round++) {
+            changed = false;
+            for (size_t i = 0; i < m_passes.size(); i++)
+                if (m_passes[i]->run(module, func)) {
+                    m_changes[i]++;
+                    changed = true;
+                }
+        }
+    }
+    remove_unused_functions(module);
+}
+
+void PassManager::print_stats(ostream& out) const {
+    for (size_t i = 0; i < m_passes.size(); i++)
+        out << "pass " << m_passes[i]->name() << ": "
+            << m_changes[i] << " functions changed\n";
+}
+
+void add_default_passes(PassManager& pm) {
+    pm.add<Inliner>();
+    pm.add<ConstantFolding>();
+    pm.add<CopyPropagation>();
+    pm.add<DeadCodeElimination>();
+    pm.add<SimplifyCFG>();
+    pm.add<BranchFusion>();
+    pm.add<AccumulatorRecursion>();
+    pm.add<TailCallElimination>();
+    // après la récursion terminale, qui reconnaît les multiplications
+    pm.add<StrengthReduction>();
+}
+
+// réécrit instr en dst = copy val
+static void make_copy(Instr& instr, Value val) {
+    instr.op = IROp::COPY;
+    instr.a = val;
+    instr.b = {};
+}
+
+void remove_unused_functions(IRModule& module) {
+    int n = module.funcs.size();
+    vector<bool> used(n, false);
+    vector<int> stack;
+    for (const IRFunction& func : module.funcs)
+        if (func.is_main) {
+            used[func.id] = true;
+            stack.push_back(func.id);
+        }
+    // sans main, tout le programme est gardé
+    if (stack.empty()) return;
+    while (!stack.empty()) {
+        int f = stack.back();
+        stack.pop_back();
+        for (const BasicBlock& block : module.funcs[f].blocks)
+            for (const Instr& instr : block.instrs)
+                if (instr.callee != -1 && !used[instr.callee]) {
+                    used[instr.callee] = true;
+                    stack.push_back(instr.callee);
+                }
+    }
+    for (int f = 0; f < n; f++)
+        if (!used[f]) module.funcs[f].blocks.clear();
+}
+
+// nombre d'instructions qui produiront du code machine
+static int function_size(const IRFunction& func) {
+    int size = 0;
+    for (const BasicBlock& block : func.blocks)
+        for (const Instr& instr : block.instrs)
+            if (instr.op != IROp::ARG && instr.op != IROp::RET && instr.op != IROp::JMP)
+                size++;
+    return size;
+}
+
+static bool calls_itself(const IRFunction& func) {
+    for (const BasicBlock& block : func.blocks)
+        for (const Instr& instr : block.instrs)
+            if (instr.callee == func.id) return true;
+    return false;
+}
+
+bool Inliner::should_inline(const IRModule& module, const IRFunction& caller, const Instr& call) const {
+    if (call.op != IROp::CALL || call.callee == caller.id) return false;
+    const IRFunction& callee = module.funcs[call.callee];
+    if (callee.is_main || callee.blocks.empty() || calls_itself(callee)) return false;
+    int size = function_size(callee);
+    return size <= small_size || (m_calls[callee.id] == 1 && size <= single_call_size);
+}
+
+// remplace l'appel instrs[i] du bloc b par le corps de l'appelé ; b et i
+// désignent ensuite la première instruction qui suivait l'appel
+static void inline_call(IRModule& module, IRFunction& func, int& b, size_t& i) {
+    const IRFunction& callee = module.funcs[func.blocks[b].instrs[i].callee];
+    Instr call = std::move(func.blocks[b].instrs[i]);
+    int offset = func.vregs_nb;
+    func.vregs_nb += callee.vregs_nb;
+    int first_block = b+1;
+    bool single_block = callee.blocks.size() == 1;
+    int cont = single_block ? b : first_block + callee.blocks.size();
+
+    // traduction d'un bloc de l'appelé dans le contexte de l'appelant
+    auto translate = [&](const BasicBlock& block, vector<Instr>& out) {
+        for (Instr instr : block.instrs) {
+            if (instr.dst.is_vreg()) instr.dst.val += offset;
+            instr.map_uses([&](Value& use) { use.val += offset; });
+            if (instr.target != -1) instr.target += first_block;
+            if (instr.target2 != -1) instr.target2 += first_block;
+            if (instr.op == IROp::ARG) {
+                instr = {IROp::COPY, instr.dst, call.args[instr.a.val]};
+            } else if (instr.op == IROp::RET || instr.op == IROp::TAILCALL) {
+                if (instr.op == IROp::RET) out.push_back({IROp::COPY, call.dst, instr.a});
+                else {
+                    instr.op = IROp::CALL;
+                    instr.dst = call.dst;
+                    out.push_back(std::move(instr));
+                }
+                if (single_block) return;
+                instr = {IROp::JMP};
+                instr.target = cont;
+            }
+            out.push_back(std::move(instr));
+        }
+    };
+
+    // les blocs sont insérés avant de déplacer la fin du bloc, dont les
+    // cibles de saut doivent être renumérotées comme les autres
+    if (!single_block) func.insert_blocks(first_block, callee.blocks.size() + 1);
+    vector<Instr>& instrs = func.blocks[b].instrs;
+    vector<Instr> post(make_move_iterator(instrs.begin()+i+1), make_move_iterator(instrs.end()));
+    instrs.resize(i);
+    if (single_block) {
+        translate(callee.blocks[0], instrs);
+        i = instrs.size();
+        instrs.insert(instrs.end(), make_move_iterator(post.begin()), make_move_iterator(post.end()));
+        return;
+    }
+    instrs.push_back({IROp::JMP});
+    instrs.back().target = first_block;
+    for (const BasicBlock& block : callee.blocks)
+        translate(block, func.blocks[first_block + block.id].instrs);
+    func.blocks[cont].instrs = std::move(post);
+    b = cont;
+    i = 0;
+}
+
+bool Inliner::run(IRModule& module, IRFunction& func) {
+    if (m_calls.empty()) {
+        m_calls.assign(module.funcs.size(), 0);
+        for (const IRFunction& f : module.funcs)
+            for (const BasicBlock& block : f.blocks)
+                for (const Instr& instr : block.instrs)
+                    if (instr.callee != -1) m_calls[instr.callee]++;
+    }
+    bool changed = false;
+    for (int b = 0; b < (int)func.blocks.size(); b++)
+        for (size_t i = 0; i < func.blocks[b].instrs.size(); ) {
+            if (!should_inline(module, func, func.blocks[b].instrs[i])) {
+                i++;
+                continue;
+            }
+            inline_call(module, func, b, i);
+            changed = true;
+        }
+    return changed;
+}
+
+bool ConstantFolding::run(IRModule&, IRFunction& func) {
+    // known[v] == block.id : v vaut value[v] au point courant du bloc
+    vector<int> known(func.vregs_nb, -1);
+    vector<int64_t> value(func.vregs_nb);
+    bool changed = false;
+    for (BasicBlock& block : func.blocks)
+        for (Instr& instr : block.instrs) {
+            instr.map_uses([&](Value& use) {
+                if (known[use.val] == block.id) {
+                    use = Value::imm(value[use.val]);
+                    changed = true;
+                }
+            });
+            const Value a = instr.a, b = instr.b;
+            int64_t res;
+            switch (instr.op) {
+                case IROp::ADD: case IROp::SUB: case IROp::MUL: case IROp::DIV:
+                case IROp::MOD: case IROp::SHL: case IROp::SHR: case IROp::AND: case IROp::OR:
+                case IROp::EQ: case IROp::NE: case IROp::LT: case IROp::LE: case IROp::GT: case IROp::GE:
+                    if (a.is_imm() && b.is_imm()) {
+                        if (eval_binop(instr.op, a.val, b.val, res)) {
+                            make_copy(instr, Value::imm(res));
+                            changed = true;
+                        }
+                        break;
+                    }
+                    // pas de x / 1 : idiv divise 0:x, qui déborde dès que x est négatif
+                    if (b.is_imm() && ((b.val == 0 && (instr.op == IROp::ADD || instr.op == IROp::SUB))
+                            || (b.val == 1 && instr.op == IROp::MUL))) {
+                        make_copy(instr, a);
+                        changed = true;
+                    } else if (a.is_imm() && ((a.val == 0 && instr.op == IROp::ADD)
+                            || (a.val == 1 && instr.op == IROp::MUL))) {
+                        make_copy(instr, b);
+                        changed = true;
+                    } else if (instr.op == IROp::MUL && ((a.is_imm() && a.val == 0) || (b.is_imm() && b.val == 0))) {
+                        make_copy(instr, Value::imm(0));
+                        changed = true;
+                    } else if (instr.op == IROp::SUB && a == b) {
+                        make_copy(instr, Value::imm(0));
+                        changed = true;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            if (!instr.dst.is_vreg()) continue;
+            int d = instr.dst.val;
+            if (instr.op == IROp::COPY && instr.a.is_imm()) {
+                known[d] = block.id;
+                value[d] = instr.a.val;
+            } else
+                known[d] = -1;
+        }
+    return changed;
+}
+
+bool CopyPropagation::run(IRModule&, IRFunction& func) {
+    // l'IR n'est pas en SSA : une copie n'est remplaçable partout que si
+    // la copie et sa source ne sont définies qu'une fois (la définition
+    // unique domine alors toutes les utilisations, comme en SSA)
+    vector<int> defs(func.vregs_nb, 0);
+    vector<const Instr*> def_instr(func.vregs_nb, nullptr);
+    for (const BasicBlock& block : func.blocks)
+        for (const Instr& instr : block.instrs)
+            if (instr.dst.is_vreg()) {
+                defs[instr.dst.val]++;
+                def_instr[instr.dst.val] = &instr;
+            }
+
+    auto source = [&](int v) -> Value {
+        const Instr* def = def_instr[v];
+        if (defs[v] != 1 || def->op != IROp::COPY) return Value::vreg(v);
+        if (def->a.is_vreg() && defs[def->a.val] != 1) return Value::vreg(v);
+        return def->a;
+    };
+    // on remonte les chaînes de copies une fois pour toutes
+    vector<Value> repl(func.vregs_nb);
+    for (int v = 0; v < func.vregs_nb; v++) {
+        Value val = Value::vreg(v);
+        for (Value next = source(v); next != val; next = source(val.val)) {
+            val = next;
+            if (!val.is_vreg()) break;
+        }
+        repl[v] = val;
+    }
+
+    // dans un bloc, une copie reste valable tant que sa source n'est pas
+    // redéfinie : version[v] compte les définitions de v déjà rencontrées
+    vector<int> version(func.vregs_nb, 0), copy_block(func.vregs_nb, -1), copy_version(func.vregs_nb);
+    vector<Value> copy_src(func.vregs_nb);
+    bool changed = false;
+    for (BasicBlock& block : func.blocks)
+        for (Instr& instr : block.instrs) {
+            instr.map_uses([&](Value& use) {
+                int v = use.val;
+                if (repl[v] != use) {
+                    use = repl[v];
+                    changed = true;
+                } else if (copy_block[v] == block.id && version[copy_src[v].val] == copy_version[v]) {
+                    use = copy_src[v];
+                    changed = true;
+                }
+            });
+            if (!instr.dst.is_vreg()) continue;
+            int d = instr.dst.val;
+            version[d]++;
+            copy_block[d] = -1;
+            if (instr.op == IROp::COPY && instr.a.is_vreg() && instr.a != instr.dst) {
+                copy_block[d] = block.id;
+                copy_src[d] = instr.a;
+                copy_version[d] = version[instr.a.val];
+            }
+        }
+    return changed;
+}
+
+bool DeadCodeElimination::run(IRModule&, IRFunction& func) {
+    Liveness live = compute_liveness(func);
+    // alive[v] == block.id : v est vivant au point courant du bloc
+    vector<int> alive(func.vregs_nb, -1);
+    bool changed = false;
+    for (BasicBlock& block : func.blocks) {
+        for (int v : live.live_out[block.id]) alive[v] = block.id;
+        vector<Instr>& instrs = block.instrs;
+        // parcours à l'envers, les instructions gardées sont compactées en fin de bloc
+        auto kept = instrs.rbegin();
+        for (auto it = instrs.rbegin(); it != instrs.rend(); ++it) {
+            bool self_copy = it->op == IROp::COPY && it->a == it->dst;
+            bool dead = it->dst.is_vreg() && alive[it->dst.val] != block.id
+                && !it->has_side_effects();
+            if (self_copy || dead) {
+                changed = true;
+                continue;
+            }
+            if (it->dst.is_vreg()) alive[it->dst.val] = -1;
+            it->for_each_use([&](int v) { alive[v] = block.id; });
+            if (kept != it) *kept = std::move(*it);
+            ++kept;
+        }
+        instrs.erase(instrs.begin(), kept.base());
+    }
+    return changed;
+}
+
+bool SimplifyCFG::run(IRModule&, IRFunction& func) {
+    int n = func.blocks.size();
+    bool changed = false;
+    auto is_empty_jump = [&](int b) {
+        const vector<Instr>& instrs = func.blocks[b].instrs;
+        return instrs.size() == 1 && instrs[0].op == IROp::JMP;
+    };
+    // un saut vers un bloc qui ne fait que sauter va directement à la destination
+    auto thread = [&](int& target) {
+        for (int steps = 0; steps < n && is_empty_jump(target); steps++) {
+            int next = func.blocks[target].instrs[0].target;
+            if (next == target) break;
+            target = next;
+            changed = true;
+        }
+    };
+    // bloc de sortie court : quelques copies puis ret, recopié à la place
+    // du saut qui y mène pour exposer les appels terminaux
+    auto is_small_return = [&](int b) {
+        const vector<Instr>& instrs = func.blocks[b].instrs;
+        if (instrs.empty() || instrs.size() > 8 || instrs.back().op != IROp::RET) return false;
+        return all_of(instrs.begin(), instrs.end()-1, [](const Instr& i) { return i.op == IROp::COPY; });
+    };
+    // à l'envers, pour que les sorties des if imbriqués se propagent en un seul passage
+    for (auto it = func.blocks.rbegin(); it != func.blocks.rend(); ++it) {
+        BasicBlock& block = *it;
+        if (block.instrs.empty()) continue;
+        Instr& last = block.instrs.back();
+        if (last.op == IROp::JMP) {
+            thread(last.target);
+            int target = last.target;
+            if (target != block.id && is_small_return(target)) {
+                block.instrs.pop_back();
+                const vector<Instr>& tail = func.blocks[target].instrs;
+                block.instrs.insert(block.instrs.end(), tail.begin(), tail.end());
+                changed = true;
+            }
+        } else if (last.op == IROp::BR) {
+            thread(last.target);
+            thread(last.target2);
+            int64_t taken;
+            bool constant = last.a.is_imm() && last.b.is_imm() && eval_binop(last.cond, last.a.val, last.b.val, taken);
+            if (constant || last.target == last.target2) {
+                int target = constant && !taken ? last.target2 : last.target;
+                last = {IROp::JMP};
+                last.target = target;
+                changed = true;
+            }
+        }
+    }
+
+    vector<int> preds(n, 0);
+    for (const BasicBlock& block : func.blocks)
+        for (int succ : func.successors(block))
+            preds[succ]++;
+    // fusion d'un bloc avec son successeur quand celui-ci n'a pas d'autre prédécesseur
+    for (int b = 0; b < n; b++) {
+        vector<Instr>& instrs = func.blocks[b].instrs;
+        while (!instrs.empty() && instrs.back().op == IROp::JMP) {
+            int succ = instrs.back().target;
+            if (succ == b || succ == 0 || preds[succ] != 1) break;
+            instrs.pop_back();
+            vector<Instr>& moved = func.blocks[succ].instrs;
+            instrs.insert(instrs.end(), make_move_iterator(moved.begin()), make_move_iterator(moved.end()));
+            moved.clear();
+            preds[succ] = 0;
+            changed = true;
+        }
+    }
+
+    // suppression des blocs inaccessibles depuis l'entrée, en gardant l'ordre
+    vector<bool> reachable(n, false);
+    vector<int> stack = {0};
+    reachable[0] = true;
+    while (!stack.empty()) {
+        int b = stack.back();
+        stack.pop_back();
+        for (int succ : func.successors(func.blocks[b]))
+            if (!reachable[succ]) {
+                reachable[succ] = true;
+                stack.push_back(succ);
+            }
+    }
+    if (find(reachable.begin(), reachable.end(), false) == reachable.end())
+        return changed;
+    vector<int> new_id(n, -1);
+    vector<BasicBlock> blocks;
+    for (int b = 0; b < n; b++)
+        if (reachable[b]) {
+            new_id[b] = blocks.size();
+            blocks.push_back(std::move(func.blocks[b]));
+            blocks.back().id = new_id[b];
+        }
+    for (BasicBlock& block : blocks)
+        for (Instr& instr : block.instrs) {
+            if (instr.target != -1) instr.target = new_id[instr.target];
+            if (instr.target2 != -1) instr.target2 = new_id[instr.target2];
+        }
+    func.blocks = std::move(blocks);
+    return true;
+}
+
+bool BranchFusion::run(IRModule&, IRFunction& func) {
+    vector<int> uses(func.vregs_nb, 0);
+    for (const BasicBlock& block : func.blocks)
+        for (const Instr& instr : block.instrs)
+            instr.for_each_use([&](int v) { uses[v]++; });
+    bool changed = false;
+    for (BasicBlock& block : func.blocks) {
+        vector<Instr>& instrs = block.instrs;
+        if (instrs.empty()) continue;
+        Instr& br = instrs.back();
+        if (br.op != IROp::BR || !br.a.is_vreg() || br.b != Value::imm(0)
+                || (br.cond != IROp::NE && br.cond != IROp::EQ) || uses[br.a.val] != 1)
+            continue;
+        int j = instrs.size()-2;
+        while (j >= 0 && instrs[j].dst != br.a) j--;
+        if (j < 0) continue;
+        const Instr& def = instrs[j];
+        if (!is_comparison(def.op) && def.op != IROp::SUB) continue;
+        // les opérandes doivent avoir encore la même valeur au branchement
+        bool clobbered = false;
+        for (int k = j+1; k < (int)instrs.size()-1; k++)
+            clobbered |= instrs[k].dst.is_vreg() && (instrs[k].dst == def.a || instrs[k].dst == def.b);
+        if (clobbered) continue;
+        // a - b != 0 <=> a != b
+        IROp cond = def.op == IROp::SUB ? IROp::NE : def.op;
+        br.cond = br.cond == IROp::NE ? cond : negate_comparison(cond);
+        br.a = def.a;
+        br.b = def.b;
+        instrs.erase(instrs.begin()+j);
+        changed = true;
+    }
+    return changed;
+}
+
+// log2(c) si c est une puissance de 2 supérieure à 1, -1 sinon
+static int shift_amount(Value c) {
+    if (!c.is_imm() || c.val <= 1 || (c.val & (c.val-1))) return -1;
+    return __builtin_ctzll(c.val);
+}
+
+bool StrengthReduction::run(IRModule&, IRFunction& func) {
+    vector<int> uses(func.vregs_nb, 0);
+    for (const BasicBlock& block : func.blocks)
+        for (const Instr& instr : block.instrs)
+            instr.for_each_use([&](int v) { uses[v]++; });
+    bool changed = false;
+    // def[v] : position dans le bloc de la dernière définition de v, -1 si
+    // elle est dans un autre bloc. seen_a/seen_b[i] : celle que lisait
+    // l'instruction i, pour vérifier qu'un opérande n'a pas changé depuis.
+    vector<int> def(func.vregs_nb), seen_a, seen_b;
+    vector<int> stamp(func.vregs_nb, -1);
+    for (BasicBlock& block : func.blocks) {
+        auto def_of = [&](Value v) { return v.is_vreg() && stamp[v.val] == block.id ? def[v.val] : -1; };
+        vector<Instr> out;
+        out.reserve(block.instrs.size());
+        seen_a.clear();
+        seen_b.clear();
+        // position de la dernière instruction avec effet de bord
+        int last_effect = -1;
+        auto push = [&](Instr instr) {
+            seen_a.push_back(def_of(instr.a));
+            seen_b.push_back(def_of(instr.b));
+            if (instr.has_side_effects()) last_effect = out.size();
+            if (instr.dst.is_vreg()) {
+                stamp[instr.dst.val] = block.id;
+                def[instr.dst.val] = out.size();
+            }
+            out.push_back(std::move(instr));
+        };
+        // m = (x / y) * y calculé dans le bloc, avec x et y inchangés depuis :
+        // renvoie y. Le reste s'arrête sur les mêmes diviseurs que x / y,
+        // qui est supprimé quand il ne sert qu'à m et qu'aucun effet de bord
+        // ne les sépare.
+        auto quotient_product = [&](Value m, Value x, Value& y) {
+            int j = def_of(m);
+            if (j < 0 || out[j].op != IROp::MUL) return false;
+            for (int side = 0; side < 2; side++) {
+                Value q = side ? out[j].b : out[j].a;
+                y = side ? out[j].a : out[j].b;
+                int k = side ? seen_b[j] : seen_a[j];
+                int y_def = side ? seen_a[j] : seen_b[j];
+                if (k < 0 || out[k].op != IROp::DIV || out[k].dst != q || out[k].a != x || out[k].b != y
+                        || seen_a[k] != def_of(x) || seen_b[k] != def_of(y) || y_def != def_of(y))
+                    continue;
+                if (last_effect == k && uses[q.val] == 1 && uses[m.val] == 1) {
+                    make_copy(out[k], Value::imm(0));
+                    make_copy(out[j], Value::imm(0));
+                    last_effect = -1;
+                }
+                return true;
+            }
+            return false;
+        };
+        for (Instr& instr : block.instrs) {
+            Value y;
+            bool right;
+            if (instr.op == IROp::SUB && quotient_product(instr.b, instr.a, y)) {
+                // x - (x / y) * y
+                instr.op = IROp::MOD;
+                instr.b = y;
+                changed = true;
+            } else if (instr.op == IROp::SUB && quotient_product(instr.a, instr.b, y)) {
+                // (x / y) * y - x = -(x % y)
+                Value rem = Value::vreg(func.vregs_nb++);
+                def.push_back(-1);
+                stamp.push_back(-1);
+                push({IROp::MOD, rem, instr.b, y});
+                instr.a = Value::imm(0);
+                instr.b = rem;
+                changed = true;
+            } else if (instr.op == IROp::BR && (instr.cond == IROp::EQ || instr.cond == IROp::NE)
+                    && ((right = quotient_product(instr.b, instr.a, y)) || quotient_product(instr.a, instr.b, y))) {
+                // branchement fusionné sur (x / y) * y - x
+                Value x = right ? instr.a : instr.b;
+                Value rem = Value::vreg(func.vregs_nb++);
+                def.push_back(-1);
+                stamp.push_back(-1);
+                push({IROp::MOD, rem, x, y});
+                instr.a = rem;
+                instr.b = Value::imm(0);
+                changed = true;
+            }
+            push(std::move(instr));
+        }
+        block.instrs = std::move(out);
+    }
+
+    for (BasicBlock& block : func.blocks)
+        for (Instr& instr : block.instrs) {
+            int shift;
+            if (instr.op == IROp::MUL && shift_amount(instr.a) >= 0)
+                swap(instr.a, instr.b);
+            if (instr.op == IROp::MUL && (shift = shift_amount(instr.b)) >= 0) {
+                instr.op = IROp::SHL;
+                instr.b = Value::imm(shift);
+            } else if (instr.op == IROp::DIV && (shift = shift_amount(instr.b)) >= 0) {
+                instr.op = IROp::SHR;
+                instr.b = Value::imm(shift);
+            } else if (instr.op == IROp::MOD && instr.b.is_imm()) {
+                // le reste ne dépend pas du signe du diviseur
+                uint64_t d = instr.b.val < 0 ? -(uint64_t)instr.b.val : instr.b.val;
+                if (d <= 1 || (d & (d-1))) continue;
+                instr.op = IROp::AND;
+                instr.b = Value::imm(d-1);
+            } else
+                continue;
+            changed = true;
+        }
+    return changed;
+}
+
+// sépare les ARG du bloc d'entrée dans un nouveau bloc 0 qui saute vers
+// l'ancien, devenu le bloc 1 : c'est l'en-tête des boucles de récursion
+static void split_entry(IRFunction& func) {
+    func.insert_blocks(0, 1);
+    vector<Instr>& body = func.blocks[1].instrs;
+    auto first = find_if(body.begin(), body.end(), [](const Instr& i) { return i.op != IROp::ARG; });
+    vector<Instr>& entry = func.blocks[0].instrs;
+    entry.assign(make_move_iterator(body.begin()), make_move_iterator(first));
+    body.erase(body.begin(), first);
+    entry.push_back({IROp::JMP});
+    entry.back().target = 1;
+}
+
+static bool is_loop_entry(const IRFunction& func) {
+    const vector<Instr>& entry = func.blocks[0].instrs;
+    return func.blocks.size() > 1 && entry.back().op == IROp::JMP && entry.back().target == 1
+        && all_of(entry.begin(), entry.end()-1, [](const Instr& i) { return i.op == IROp::ARG; });
+}
+
+// appel récursif terminal : réaffectation parallèle des arguments, via des
+// temporaires, puis saut à l'en-tête de boucle
+static void jump_to_header(IRFunction& func, vector<Instr>& instrs, const vector<Value>& args) {
+    vector<Value> arg_vregs(func.args_nb);
+    for (const Instr& instr : func.blocks[0].instrs)
+        if (instr.op == IROp::ARG) arg_vregs[instr.a.val] = instr.dst;
+    vector<Value> temps(func.args_nb);
+    for (int k = 0; k < func.args_nb; k++) {
+        if (!arg_vregs[k].is_vreg()) continue;
+        temps[k] = Value::vreg(func.vregs_nb++);
+        instrs.push_back({IROp::COPY, temps[k], args[k]});
+    }
+    for (int k = 0; k < func.args_nb; k++)
+        if (arg_vregs[k].is_vreg())
+            instrs.push_back({IROp::COPY, arg_vregs[k], temps[k]});
+    instrs.push_back({IROp::JMP});
+    instrs.back().target = 1;
+}
+
+bool TailCallElimination::run(IRModule& module, IRFunction& func) {
+    if (func.is_main) return false;
+    bool changed = false;
+    for (size_t b = 0; b < func.blocks.size(); b++) {
+        vector<Instr>& instrs = func.blocks[b].instrs;
+        if (instrs.empty() || instrs.back().op != IROp::RET) continue;
+        // on remonte les copies jusqu'à l'appel dont la valeur est retournée
+        Value res = instrs.back().a;
+        int i = instrs.size()-2;
+        for (; i >= 0 && instrs[i].op == IROp::COPY; i--)
+            if (instrs[i].dst == res) res = instrs[i].a;
+        if (i < 0 || instrs[i].op != IROp::CALL || instrs[i].dst != res) continue;
+        // l'appelé lit ses arguments empilés juste au-dessus de l'adresse de
+        // retour : ceux de l'appelant doivent lui laisser assez de place
+        const IRFunction& callee = module.funcs[instrs[i].callee];
+        if (callee.args_nb > REG_ARGS_NB && callee.args_nb > func.args_nb) continue;
+
+        Instr call = std::move(instrs[i]);
+        instrs.erase(instrs.begin()+i, instrs.end());
+        changed = true;
+        if (call.callee != func.id) {
+            call.op = IROp::TAILCALL;
+            call.dst = {};
+            instrs.push_back(std::move(call));
+            continue;
+        }
+        if (!is_loop_entry(func)) {
+            split_entry(func);
+            b++;
+        }
+        jump_to_header(func, func.blocks[b].instrs, call.args);
+    }
+    return changed;
+}
+
+// l'opérateur ne peut modifier le tape qu'à travers ses appels récursifs
+static bool never_writes_tape(const IRFunction& func) {
+    for (const BasicBlock& block : func.blocks)
+        for (const Instr& instr : block.instrs) {
+            if (instr.writes_tape() || instr.op == IROp::TAILCALL)
+                return false;
+            if (instr.op == IROp::CALL && instr.callee != func.id) return false;
+        }
+    return true;
+}
+
+// site de récursion linéaire : %c = call f ; post ; %r = op %c, X ; copies ; ret %r
+// (combine = -1 et op = COPY pour un simple appel terminal)
+struct AccumulatorSite{
+    int block, call, combine;
+    IROp op;
+    Value operand;
+};
+
+static bool find_accumulator_site(const IRFunction& func, int b, bool read_only, AccumulatorSite& site) {
+    const vector<Instr>& instrs = func.blocks[b].instrs;
+    if (instrs.empty() || instrs.back().op != IROp::RET) return false;
+    Value res = instrs.back().a;
+    int i = instrs.size()-2;
+    for (; i >= 0 && instrs[i].op == IROp::COPY; i--)
+        if (instrs[i].dst == res) res = instrs[i].a;
+    if (i < 0 || instrs[i].dst != res) return false;
+    // appel terminal : l'accumulateur est transmis tel quel
+    if (instrs[i].op == IROp::CALL && instrs[i].callee == func.id) {
+        site = {b, i, -1, IROp::COPY, {}};
+        return true;
+    }
+    const Instr& combine = instrs[i];
+    if (combine.op != IROp::ADD && combine.op != IROp::MUL && combine.op != IROp::SUB) return false;
+
+    auto is_self_call = [&](Value v, int& j) {
+        if (!v.is_vreg()) return false;
+        for (j = i-1; j >= 0 && instrs[j].dst != v; j--);
+        return j >= 0 && instrs[j].op == IROp::CALL && instrs[j].callee == func.id;
+    };
+    int j;
+    Value operand;
+    if (is_self_call(combine.a, j)) operand = combine.b;
+    else if (combine.op != IROp::SUB && is_self_call(combine.b, j)) operand = combine.a;
+    else return false;
+    const Instr& call = instrs[j];
+    if (operand == call.dst) return false;
+
+    // les instructions entre l'appel et la combinaison seront calculées avant l'appel
+    for (int k = j+1; k < i; k++) {
+        const Instr& post = instrs[k];
+        if (post.has_side_effects() || (post.op == IROp::LOAD && !read_only)) return false;
+        bool uses_call = false;
+        post.for_each_use([&](int v) { uses_call |= v == call.dst.val; });
+        if (uses_call) return false;
+        if (post.dst.is_vreg())
+            for (const Value& arg : call.args)
+                if (arg == post.dst) return false;
+    }
+    site = {b, j, i, combine.op, operand};
+    return true;
+}
+
+bool AccumulatorRecursion::run(IRModule& module, IRFunction& func) {
+    if (func.is_main) return false;
+    if (m_done.size() < module.funcs.size()) m_done.resize(module.funcs.size());
+    if (m_done[func.id]) return false;
+    bool read_only = never_writes_tape(func);
+    vector<AccumulatorSite> sites;
+    // opération d'accumulation des sites trouvés, COPY s'il n'y en a pas encore
+    IROp op = IROp::COPY;
+    for (int b = 0; b < (int)func.blocks.size(); b++) {
+        AccumulatorSite site;
+        if (!find_accumulator_site(func, b, read_only, site)) continue;
+        // tous les sites doivent accumuler avec la même opération
+        if (site.op != IROp::COPY) {
+            if (op != IROp::COPY && (site.op == IROp::MUL) != (op == IROp::MUL)) continue;
+            op = site.op;
+        }
+        sites.push_back(site);
+    }
+    // sans combinaison, c'est le travail de TailCallElimination
+    if (op == IROp::COPY) return false;
+    for (const BasicBlock& block : func.blocks)
+        for (const Instr& instr : block.instrs)
+            if (instr.op == IROp::TAILCALL) return false;
+    m_done[func.id] = true;
+
+    bool mul = op == IROp::MUL;
+    if (!is_loop_entry(func)) {
+        split_entry(func);
+        // les ARG du bloc 0 sont passés dans le nouveau bloc d'entrée, avant
+        // son saut : les positions d'un site de ce bloc reculent d'autant
+        int args_moved = func.blocks[0].instrs.size() - 1;
+        for (AccumulatorSite& site : sites) {
+            if (site.block == 0) {
+                site.call -= args_moved;
+                if (site.combine != -1) site.combine -= args_moved;
+            }
+            site.block++;
+        }
+    }
+    Value acc = Value::vreg(func.vregs_nb++);
+    vector<Instr>& entry = func.blocks[0].instrs;
+    entry.insert(entry.end()-1, {IROp::COPY, acc, Value::imm(mul ? 1 : 0)});
+
+    // les autres ret combinent leur valeur avec l'accumulateur
+    vector<bool> is_site(func.blocks.size(), false);
+    for (const AccumulatorSite& site : sites) is_site[site.block] = true;
+    for (BasicBlock& block : func.blocks) {
+        if (is_site[block.id] || block.instrs.empty() || block.instrs.back().op != IROp::RET) continue;
+        Instr& ret = block.instrs.back();
+        Value res = Value::vreg(func.vregs_nb++);
+        Instr combine = {mul ? IROp::MUL : IROp::ADD, res, acc, ret.a};
+        ret.a = res;
+        block.instrs.insert(block.instrs.end()-1, combine);
+    }
+
+    for (const AccumulatorSite& site : sites) {
+        vector<Instr>& instrs = func.blocks[site.block].instrs;
+        Instr call = std::move(instrs[site.call]);
+        vector<Instr> loop(make_move_iterator(instrs.begin()), make_move_iterator(instrs.begin()+site.call));
+        if (site.combine != -1) {
+            loop.insert(loop.end(), make_move_iterator(instrs.begin()+site.call+1),
+                        make_move_iterator(instrs.begin()+site.combine));
+            loop.push_back({site.op, acc, acc, site.operand});
+        }
+        jump_to_header(func, loop, call.args);
+        instrs = std::move(loop);
+    }
+    return true;
+}
+
+// nombre d'entrées d'une table de mémoïsation, et d'entrées consécutives
+// essayées à partir de celle désignée par le hachage ; la table en a
+// memo_probes - 1 de plus pour ne jamais revenir au début
+static const int memo_log_entries = 12;
+static const int memo_probes = 4;
+// taille maximale de la zone de mémoïsation, projetée par main avant le tape
+static const int64_t memo_max_size = 1 << 21;
+// hachage de Fibonacci : 2^64 divisé par le nombre d'or
+static const int64_t memo_hash_factor = (int64_t)0x9E3779B97F4A7C15ull;
+
+// opérateurs dont le résultat ne dépend que des arguments : on suppose
+// tout le monde pur et on retire jusqu'à stabilité ceux qui accèdent au
+// tape, font une entrée-sortie ou appellent un opérateur impur
+static vector<bool> pure_functions(const IRModule& module) {
+    vector<bool> pure(module.funcs.size());
+    for (const IRFunction& func : module.funcs)
+        pure[func.id] = !func.is_main && !func.blocks.empty();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const IRFunction& func : module.funcs) {
+            if (!pure[func.id]) continue;
+            for (const BasicBlock& block : func.blocks)
+                for (const Instr& instr : block.instrs)
+                    if (instr.reads_tape() || instr.writes_tape() || instr.op == IROp::FLUSH
+                        || instr.op == IROp::MLOAD || instr.op == IROp::MSTORE
+                        || (instr.callee != -1 && !pure[instr.callee]))
+                        pure[func.id] = false;
+            changed |= !pure[func.id];
+        }
+    }
+    return pure;
+}
+
+// un appel ou une boucle : sans, recalculer coûte moins qu'une recherche
+static bool worth_memoizing(const IRFunction& func) {
+    for (const BasicBlock& block : func.blocks) {
+        for (const Instr& instr : block.instrs)
+            if (instr.callee != -1) return true;
+        for (int succ : func.successors(block))
+            if (succ <= block.id) return true;
+    }
+    return false;
+}
+
+// remplace func par une fonction de même numéro qui cherche ses arguments
+// dans la table à l'octet base de la zone de mémoïsation, et appelle sinon
+// body, le corps d'origine, avant d'enregistrer le résultat. Une entrée
+// est (1, arguments, résultat), à zéro tant qu'elle est libre ; quand les
+// entrées essayées sont toutes prises, la première est remplacée.
+static void build_memo_lookup(IRModule& module, IRFunction& func, int body, int64_t base) {
+    int n = func.args_nb;
+    int64_t entry_size = 8*(n + 2);
+    func.blocks.clear();
+    func.vregs_nb = 0;
+    IRBuilder ir{module};
+    ir.set_function(func);
+
+    int entry = ir.new_block(), probe = ir.new_block();
+    vector<int> compare(n);
+    for (int i = 0; i < n; i++)
+        compare[i] = ir.new_block();
+    int hit = ir.new_block(), next = ir.new_block(), full = ir.new_block(), miss = ir.new_block();
+
+    ir.set_block(entry);
+    vector<Value> args(n);
+    Value hash = Value::imm(0);
+    for (int i = 0; i < n; i++) {
+        args[i] = Value::vreg(ir.new_vreg());
+        ir.emit(IROp::ARG, args[i], Value::imm(i));
+        hash = ir.binop(IROp::MUL, i ? ir.binop(IROp::ADD, hash, args[i]) : args[i],
+                        Value::imm(memo_hash_factor));
+    }
+    Value slot = Value::vreg(ir.new_vreg()), end = Value::vreg(ir.new_vreg());
+    Value index = ir.binop(IROp::SHR, hash, Value::imm(64 - memo_log_entries));
+    ir.emit(IROp::ADD, slot, ir.binop(IROp::MUL, index, Value::imm(entry_size)), Value::imm(base));
+    ir.emit(IROp::ADD, end, slot, Value::imm(memo_probes*entry_size));
+    ir.jmp(probe);
+
+    // une entrée libre termine la recherche : la clé n'a jamais été enregistrée
+    ir.set_block(probe);
+    Instr& free_entry = ir.emit(IROp::BR, {}, ir.binop(IROp::MLOAD, slot, {}), Value::imm(0));
+    free_entry.cond = IROp::EQ;
+    free_entry.target = miss;
+    free_entry.target2 = compare[0];
+    for (int i = 0; i < n; i++) {
+        ir.set_block(compare[i]);
+        Value key = ir.binop(IROp::MLOAD, ir.binop(IROp::ADD, slot, Value::imm(8*(i+1))), {});
+        Instr& differs = ir.emit(IROp::BR, {}, key, args[i]);
+        differs.cond = IROp::NE;
+        differs.target = next;
+        differs.target2 = i+1 < n ? compare[i+1] : hit;
+    }
+    ir.set_block(hit);
+    ir.emit(IROp::RET, {}, ir.binop(IROp::MLOAD, ir.binop(IROp::ADD, slot, Value::imm(8*(n+1))), {}));
+
+    ir.set_block(next);
+    ir.emit(IROp::ADD, slot, slot, Value::imm(entry_size));
+    Instr& more = ir.emit(IROp::BR, {}, slot, end);
+    more.cond = IROp::LT;
+    more.target = probe;
+    more.target2 = full;
+    ir.set_block(full);
+    ir.emit(IROp::SUB, slot, slot, Value::imm(memo_probes*entry_size));
+    ir.jmp(miss);
+
+    ir.set_block(miss);
+    Value res = Value::vreg(ir.new_vreg());
+    Instr& call = ir.emit(IROp::CALL, res);
+    call.callee = body;
+    call.args = args;
+    for (int i = 0; i < n; i++)
+        ir.emit(IROp::MSTORE, {}, ir.binop(IROp::ADD, slot, Value::imm(8*(i+1))), args[i]);
+    ir.emit(IROp::MSTORE, {}, ir.binop(IROp::ADD, slot, Value::imm(8*(n+1))), res);
+    ir.emit(IROp::MSTORE, {}, slot, Value::imm(1));
+    ir.emit(IROp::RET, {}, res);
+}
+
+int memoize_pure_functions(IRModule& module) {
+    vector<bool> pure = pure_functions(module);
+    int memoized = 0;
+    int funcs_nb = module.funcs.size();
+    for (int f = 0; f < funcs_nb; f++) {
+        const IRFunction& func = module.funcs[f];
+        if (!pure[f] || !func.args_nb || !worth_memoizing(func)) continue;
+        int64_t size = 8*(func.args_nb + 2)*((1 << memo_log_entries) + memo_probes - 1);
+        if (module.memo_size + size > memo_max_size) continue;
+        // le corps garde ses appels récursifs, qui passent par la table
+        IRFunction body = func;
+        body.id = module.funcs.size();
+        module.funcs.push_back(std::move(body));
+        build_memo_lookup(module, module.funcs[f], module.funcs.back().id, module.memo_size);
+        module.memo_size += size;
+        memoized++;
+    }
+    return memoized;
+}
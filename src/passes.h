@@ -0,0 +1,151 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include "ir.h"
+
+#include <memory>
+#include <ostream>
+
+// Passe de transformation de l'IR, appliquée fonction par fonction. Le
+// module est fourni pour les passes qui ont besoin des autres fonctions.
+// Les analyses (vivacité, prédécesseurs) sont recalculées à la demande par
+// les passes qui s'en servent.
+class Pass{
+    public :
+        virtual ~Pass() = default;
+        virtual const char* name() const = 0;
+        // renvoie true si la fonction a été modifiée
+        virtual bool run(IRModule& module, IRFunction& func) = 0;
+};
+
+// Applique une suite de passes à chaque fonction, en recommençant tant
+// qu'une passe modifie la fonction (au plus max_rounds tours).
+class PassManager{
+    private :
+        vector<unique_ptr<Pass>> m_passes;
+        // nombre de fonctions modifiées par chaque passe
+        vector<size_t> m_changes;
+    public :
+        int max_rounds = 4;
+
+        template <class P, class... Args>
+        void add(Args&&... args) {
+            m_passes.push_back(make_unique<P>(std::forward<Args>(args)...));
+            m_changes.push_back(0);
+        }
+        void run(IRModule& module);
+        void print_stats(ostream& out) const;
+};
+
+// pipeline utilisé par le compilateur
+void add_default_passes(PassManager& pm);
+
+// vide les fonctions que main n'appelle plus, directement ou non,
+// pour que le codegen ne les émette pas
+void remove_unused_functions(IRModule& module);
+
+// Mémoïsation des opérateurs purs, pour --memoize : un opérateur est pur
+// s'il ne lit ni n'écrit le tape, ne fait pas d'entrée-sortie et n'appelle
+// que des opérateurs purs. Son résultat ne dépend alors que de ses
+// arguments. Ceux qui font assez de travail pour que ça vaille la peine
+// (un appel ou une boucle) sont précédés d'une recherche dans une table à
+// adressage ouvert de taille fixe, indexée par leurs arguments, placée
+// dans la zone de mémoïsation après le tape. Renvoie le nombre
+// d'opérateurs mémoïsés.
+int memoize_pure_functions(IRModule& module);
+
+// évalue les opérations du prelude dont les opérandes sont constants,
+// propage dans chaque bloc les constantes des variables redéfinies et
+// simplifie les éléments neutres et absorbants (x+0, x*1, x*0, x/1)
+class ConstantFolding : public Pass {
+    public :
+        const char* name() const override { return "constant-folding"; }
+        bool run(IRModule& module, IRFunction& func) override;
+};
+
+// remplace les utilisations d'une copie par sa source quand toutes deux
+// n'ont qu'une définition
+class CopyPropagation : public Pass {
+    public :
+        const char* name() const override { return "copy-propagation"; }
+        bool run(IRModule& module, IRFunction& func) override;
+};
+
+// supprime les instructions sans effet dont le résultat n'est jamais lu
+class DeadCodeElimination : public Pass {
+    public :
+        const char* name() const override { return "dce"; }
+        bool run(IRModule& module, IRFunction& func) override;
+};
+
+// court-circuite les blocs vides, fusionne un bloc avec son unique
+// successeur et supprime les blocs inaccessibles
+class SimplifyCFG : public Pass {
+    public :
+        const char* name() const override { return "simplify-cfg"; }
+        bool run(IRModule& module, IRFunction& func) override;
+};
+
+// Un branchement sur le résultat d'une comparaison (ou d'une soustraction,
+// pour "if (a - b)") qui n'est lu que par lui compare directement les
+// opérandes : le codegen produit cmp + jcc sans matérialiser de booléen.
+class BranchFusion : public Pass {
+    public :
+        const char* name() const override { return "branch-fusion"; }
+        bool run(IRModule& module, IRFunction& func) override;
+};
+
+// Remplace les opérations coûteuses par des équivalents moins chers :
+// x - (x / y) * y, ou un test de (x / y) * y == x, devient un reste (un
+// seul idiv), et une multiplication, division ou un reste par une
+// puissance de 2 devient un décalage ou un et.
+// La division d'un nombre non signé n'a pas besoin de correction d'arrondi.
+class StrengthReduction : public Pass {
+    public :
+        const char* name() const override { return "strength-reduction"; }
+        bool run(IRModule& module, IRFunction& func) override;
+};
+
+// Intègre le corps d'un operator à la place de ses appels quand il est
+// petit, ou assez court et appelé une seule fois dans tout le programme.
+// Les operators récursifs ne sont pas intégrés.
+class Inliner : public Pass {
+    private :
+        // nombre d'appels de chaque fonction, compté au premier passage
+        vector<int> m_calls;
+        bool should_inline(const IRModule& module, const IRFunction& caller, const Instr& call) const;
+    public :
+        // taille en instructions en dessous de laquelle on intègre toujours
+        int small_size = 8;
+        // taille maximale d'une fonction appelée une seule fois pour être intégrée
+        int single_call_size = 64;
+
+        const char* name() const override { return "inline"; }
+        bool run(IRModule& module, IRFunction& func) override;
+};
+
+// Récursion linéaire combinée par une opération associative du prelude :
+// f(x) = X + f(x') (ou X * f(x'), f(x') - X) devient une boucle avec un
+// accumulateur, puis chaque ret v retourne acc + v (ou acc * v). X doit
+// pouvoir être calculé avant l'appel : sans effet de bord, et sans lecture
+// du tape si l'opérateur peut l'écrire.
+class AccumulatorRecursion : public Pass {
+    private :
+        // fonctions déjà transformées, qui ont leur accumulateur
+        vector<bool> m_done;
+    public :
+        const char* name() const override { return "accumulator-recursion"; }
+        bool run(IRModule& module, IRFunction& func) override;
+};
+
+// Un appel dont le résultat est directement retourné devient un TAILCALL,
+// qui réutilise le cadre de l'appelant. Un appel terminal d'un opérateur à
+// lui-même devient une boucle : les arguments sont réaffectés et on saute
+// au début du corps. main, qui ne retourne pas, n'est pas concerné.
+class TailCallElimination : public Pass {
+    public :
+        const char* name() const override { return "tail-calls"; }
+        bool run(IRModule& module, IRFunction& func) override;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "regalloc.h"
+
+#include <algorithm>
+#include <climits>
+
+static const Reg callee_saved[] = {RBX, R12, R13, R14};
+static const Reg caller_saved[] = {RSI, RDI, R8, R9, R10};
+
+Allocation allocate_registers(const IRFunction& func) {
+    int n = func.vregs_nb;
+    Allocation res;
+    res.locs.resize(n);
+
+    // l'instruction numéro i lit ses opérandes en 2i et écrit dst en 2i+1
+    vector<int> first_pos(n, INT_MAX), last_pos(n, -1);
+    vector<int> arg_index(n, -1);
+    // un argument reçu en registre doit être sauvé si un appel précède son ARG
+    vector<bool> crosses_call(n, false);
+    int calls_seen = 0;
+    auto extend = [&](int v, int pos) {
+        first_pos[v] = min(first_pos[v], pos);
+        last_pos[v] = max(last_pos[v], pos);
+    };
+    Liveness live = compute_liveness(func);
+    int idx = 0;
+    for (const BasicBlock& block : func.blocks) {
+        int block_start = 2*idx;
+        for (const Instr& instr : block.instrs) {
+            instr.for_each_use([&](int v) { extend(v, 2*idx); });
+            if (instr.dst.is_vreg()) extend(instr.dst.val, 2*idx+1);
+            if (instr.op == IROp::ARG) {
+                int v = instr.dst.val;
+                arg_index[v] = instr.a.val;
+                if (arg_index[v] < REG_ARGS_NB) {
+                    extend(v, 0);
+                    if (calls_seen) crosses_call[v] = true;
+                }
+            }
+            if (instr.is_call()) calls_seen++;
+            idx++;
+        }
+        int block_end = 2*idx-1;
+        for (int v : live.live_in[block.id]) extend(v, block_start);
+        for (int v : live.live_out[block.id]) extend(v, block_end);
+    }
+
+    // un registre virtuel traverse un appel s'il est vivant juste après
+    // celui-ci : l'intervalle seul surestime (trous entre branches d'un if)
+    // (born[v] : nombre d'appels déjà vus, en remontant, quand v est devenu vivant)
+    vector<int> born(n, -1);
+    for (const BasicBlock& block : func.blocks) {
+        int calls = 0;
+        auto die = [&](int v) {
+            if (born[v] != -1 && calls > born[v]) crosses_call[v] = true;
+            born[v] = -1;
+        };
+        for (int v : live.live_out[block.id]) born[v] = 0;
+        for (auto it = block.instrs.rbegin(); it != block.instrs.rend(); ++it) {
+            if (it->dst.is_vreg()) die(it->dst.val);
+            if (it->is_call()) calls++;
+            it->for_each_use([&](int v) {
+                if (born[v] == -1) born[v] = calls;
+            });
+        }
+        for (int v : live.live_in[block.id]) die(v);
+    }
+
+    vector<int> order;
+    for (int v = 0; v < n; v++)
+        if (last_pos[v] != -1) order.push_back(v);
+    // registre d'arrivée d'un argument, s'il est allouable
+    auto hint_of = [&](int v) {
+        if (arg_index[v] == -1 || arg_index[v] >= REG_ARGS_NB) return NO_REG;
+        Reg r = arg_regs[arg_index[v]];
+        return find(begin(caller_saved), end(caller_saved), r) != end(caller_saved) ? r : NO_REG;
+    };
+    // à l'entrée, les arguments qui peuvent rester dans leur registre passent
+    // d'abord, pour que les autres ne le leur prennent pas
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        if (first_pos[a] != first_pos[b]) return first_pos[a] < first_pos[b];
+        return hint_of(a) != NO_REG && hint_of(b) == NO_REG;
+    });
+
+    // registre -> registre virtuel qui l'occupe, -1 s'il est libre
+    int owner[16];
+    fill(begin(owner), end(owner), -1);
+    bool used[16] = {};
+    vector<int> active;
+    vector<int> spilled;
+
+    for (int v : order) {
+        // un argument empilé qui traverse un appel reste dans son
+        // emplacement de pile : cela évite de sauvegarder un registre
+        // callee-saved de plus à chaque cadre
+        bool stack_arg = arg_index[v] >= REG_ARGS_NB;
+        if (stack_arg && crosses_call[v]) {
+            spilled.push_back(v);
+            continue;
+        }
+        active.erase(remove_if(active.begin(), active.end(), [&](int w) {
+            if (last_pos[w] >= first_pos[v]) return false;
+            owner[res.locs[w].reg] = -1;
+            return true;
+        }), active.end());
+
+        vector<Reg> candidates(begin(callee_saved), end(callee_saved));
+        if (!crosses_call[v])
+            candidates.insert(candidates.begin(), begin(caller_saved), end(caller_saved));
+        Reg chosen = NO_REG;
+        Reg hint = hint_of(v);
+        if (hint != NO_REG && !crosses_call[v] && owner[hint] == -1)
+            chosen = hint;
+        else
+            for (Reg r : candidates)
+                if (owner[r] == -1) {
+                    chosen = r;
+                    break;
+                }
+        if (chosen == NO_REG) {
+            // on déborde l'intervalle actif compatible qui finit le plus tard
+            int victim = -1;
+            for (int w : active)
+                if (find(candidates.begin(), candidates.end(), res.locs[w].reg) != candidates.end()
+                        && (victim == -1 || last_pos[w] > last_pos[victim]))
+                    victim = w;
+            if (victim == -1 || last_pos[victim] <= last_pos[v]) {
+                spilled.push_back(v);
+                continue;
+            }
+            chosen = res.locs[victim].reg;
+            res.locs[victim] = {};
+            active.erase(find(active.begin(), active.end(), victim));
+            spilled.push_back(victim);
+        }
+        res.locs[v] = {Location::REG, chosen};
+        owner[chosen] = v;
+        used[chosen] = true;
+        active.push_back(v);
+    }
+
+    for (Reg r : callee_saved)
+        if (used[r]) res.saved_regs.push_back(r);
+    // un argument empilé débordé reste dans l'emplacement où l'appelant l'a mis
+    int saved_nb = res.saved_regs.size();
+    for (int v : spilled) {
+        if (arg_index[v] >= REG_ARGS_NB)
+            res.locs[v] = {Location::STACK, NO_REG, 16 + 8*(func.args_nb-1-arg_index[v])};
+        else
+            res.locs[v] = {Location::STACK, NO_REG, -8*(saved_nb + 1 + res.spill_slots++)};
+    }
+    return res;
+}
@@ -0,0 +1,40 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "ir.h"
+#include "x86.h"
+
+// registres des premiers arguments d'un opérateur, dans l'ordre de la
+// convention System V ; rcx et rdx ne sont pas allouables et sont recopiés
+// dès le prologue
+inline constexpr Reg arg_regs[REG_ARGS_NB] = {RDI, RSI, RDX, RCX, R8, R9};
+
+// emplacement d'un registre virtuel après allocation
+struct Location{
+    enum Kind : uint8_t {
+        NONE, REG, STACK
+    } kind = NONE;
+    Reg reg = NO_REG;
+    // STACK : déplacement par rapport à rbp
+    int32_t offset = 0;
+};
+
+struct Allocation{
+    vector<Location> locs;
+    // registres callee-saved utilisés, à sauvegarder dans le prologue
+    vector<Reg> saved_regs;
+    // nombre d'emplacements de pile réservés sous les registres sauvegardés
+    int spill_slots = 0;
+};
+
+// Allocation par balayage linéaire (Poletto & Sarkar) : chaque registre
+// virtuel reçoit un intervalle de vie sur l'ordre linéaire des blocs, élargi
+// grâce à la vivacité entre blocs. Un intervalle qui traverse un appel ne
+// peut recevoir qu'un registre callee-saved. Faute de registre libre, on
+// déborde sur la pile l'intervalle qui finit le plus tard. Un argument reçu
+// en registre est vivant dès l'entrée, et garde si possible ce registre.
+// rax, rcx, rdx et r11 ne sont jamais alloués : le codegen s'en sert comme
+// registres de travail (division, appels système).
+Allocation allocate_registers(const IRFunction& func);
+
+#endif
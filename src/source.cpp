@@ -0,0 +1,50 @@
+#include "source.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static IOError io_error(const char* what, const char* path) {
+    stringstream err;
+    err << what << " \"" << path << "\": " << strerror(errno);
+    return IOError(err.str());
+}
+
+SourceFile::SourceFile(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) throw io_error("cannot open", path);
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        throw io_error("cannot stat", path);
+    }
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            m_data = (const char*)data;
+            m_size = st.st_size;
+            m_mapped = true;
+            close(fd);
+            return;
+        }
+    }
+    char chunk[1 << 16];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+        m_buffer.append(chunk, n);
+    close(fd);
+    if (n == -1) throw io_error("cannot read", path);
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+}
+
+SourceFile::~SourceFile()
+{
+    if (m_mapped) munmap((void*)m_data, m_size);
+}
@@ -0,0 +1,33 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Fichier source projeté en mémoire : les lexèmes des tokens sont des vues
+// sur ce texte, l'objet doit donc vivre pendant toute la compilation.
+// Si le fichier ne peut pas être projeté (pipe, fichier vide ...) il est lu
+// dans un buffer à la place.
+class SourceFile{
+    private :
+        const char* m_data = nullptr;
+        size_t m_size = 0;
+        bool m_mapped = false;
+        string m_buffer;
+    public :
+        SourceFile(const char* path);
+        ~SourceFile();
+        SourceFile(const SourceFile&) = delete;
+        SourceFile& operator=(const SourceFile&) = delete;
+
+        string_view text() const { return {m_data, m_size}; }
+};
+
+class IOError : public runtime_error {
+    using runtime_error::runtime_error;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Pool de threads exécutant des lots de tâches indépendantes.
+// Le thread appelant participe au lot et run() ne rend la main que quand
+// toutes les tâches sont terminées. Si des tâches lèvent une exception,
+// celle de plus petit indice est relancée, comme en exécution séquentielle.
+class ThreadPool{
+    private :
+        vector<thread> m_workers;
+        mutex m_mutex;
+        condition_variable m_wake, m_done;
+        const function<void(int)>* m_task = nullptr;
+        int m_tasks_nb = 0;
+        atomic<int> m_next{0};
+        int m_running = 0;
+        unsigned m_generation = 0;
+        bool m_stop = false;
+        vector<exception_ptr> m_errors;
+
+        void work() {
+            int i;
+            while ((i = m_next++) < m_tasks_nb) {
+                try {
+                    (*m_task)(i);
+                } catch (...) {
+                    m_errors[i] = current_exception();
+                }
+            }
+        }
+
+        void worker_loop() {
+            unsigned seen = 0;
+            while (true) {
+                {
+                    unique_lock lock{m_mutex};
+                    m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+                    if (m_stop) return;
+                    seen = m_generation;
+                }
+                work();
+                unique_lock lock{m_mutex};
+                if (--m_running == 0) m_done.notify_one();
+            }
+        }
+
+    public :
+        ThreadPool(int threads_nb) {
+            for (int i = 1; i < threads_nb; i++)
+                m_workers.emplace_back(&ThreadPool::worker_loop, this);
+        }
+
+        ~ThreadPool() {
+            {
+                lock_guard lock{m_mutex};
+                m_stop = true;
+            }
+            m_wake.notify_all();
+            for (thread& worker : m_workers)
+                worker.join();
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        int size() const { return m_workers.size()+1; }
+
+        // exécute task(0), ..., task(tasks_nb-1)
+        void run(int tasks_nb, const function<void(int)>& task) {
+            {
+                lock_guard lock{m_mutex};
+                m_task = &task;
+                m_tasks_nb = tasks_nb;
+                m_next = 0;
+                m_errors.assign(tasks_nb, nullptr);
+                m_running = m_workers.size();
+                m_generation++;
+            }
+            m_wake.notify_all();
+            work();
+            {
+                unique_lock lock{m_mutex};
+                m_done.wait(lock, [&] { return m_running == 0; });
+            }
+            for (exception_ptr& error : m_errors)
+                if (error) rethrow_exception(error);
+        }
+};
+
+#endif
@@ -0,0 +1,406 @@
+#include "bytecode.h"
+#include "codegen.h"
+
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// arithmétique modulo 2^64 comme les instructions x86, sans débordement
+// signé indéfini
+static inline int64_t wrap_add(int64_t a, int64_t b) { return (uint64_t)a + (uint64_t)b; }
+static inline int64_t wrap_sub(int64_t a, int64_t b) { return (uint64_t)a - (uint64_t)b; }
+static inline int64_t wrap_mul(int64_t a, int64_t b) { return (uint64_t)a * (uint64_t)b; }
+
+// comme idiv sur rdx:rax = 0:a, qui lève SIGFPE sur une division par zéro
+// ou un quotient hors de 64 bits
+static inline __int128 checked_div(int64_t a, int64_t b) {
+    __int128 q = b ? (__int128)(uint64_t)a / b : 0;
+    if (!b || q != (int64_t)q) raise(SIGFPE);
+    return q;
+}
+static inline int64_t vm_div(int64_t a, int64_t b) { return checked_div(a, b); }
+static inline int64_t vm_mod(int64_t a, int64_t b) {
+    checked_div(a, b);
+    return b ? (int64_t)((__int128)(uint64_t)a % b) : 0;
+}
+
+// accès de width octets au tape, l'hôte étant little endian comme le code natif
+static inline int64_t load_le(const uint8_t* p, int64_t width) {
+    uint64_t val = 0;
+    memcpy(&val, p, width);
+    return val;
+}
+static inline void store_le(uint8_t* p, int64_t val, int64_t width) {
+    memcpy(p, &val, width);
+}
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+// tape projeté comme celui du code natif, les adresses étant vérifiées
+// par la machine virtuelle plutôt que par des pages de garde
+class VMTape{
+    private :
+        uint8_t* m_base;
+        uint64_t m_size;
+    public :
+        VMTape(const TapeConfig& config) : m_size(config.size) {
+            // réservé seulement : les pages sont allouées au premier accès
+            void* mem = mmap(nullptr, m_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (mem == MAP_FAILED) throw runtime_error("cannot map the VM tape");
+            if (config.huge_pages) madvise(mem, m_size, MADV_HUGEPAGE);
+            if (config.populate) madvise(mem, m_size, MADV_POPULATE_WRITE);
+            m_base = (uint8_t*)mem;
+        }
+        ~VMTape() { munmap(m_base, m_size); }
+        VMTape(const VMTape&) = delete;
+        VMTape& operator=(const VMTape&) = delete;
+        uint8_t& operator[](uint64_t addr) const { return m_base[addr]; }
+        uint64_t size() const { return m_size; }
+        bool contains(uint64_t addr, uint64_t len) const {
+            return addr <= m_size && len <= m_size - addr;
+        }
+};
+
+// :print et :read, avec les tampons du runtime du code natif ou
+// directement par des appels système
+class VMIO{
+    private :
+        VMTape& m_tape;
+        const bool m_buffered;
+        uint8_t m_out[IO_BUFFER_SIZE], m_in[IO_BUFFER_SIZE];
+        size_t m_out_len = 0, m_in_pos = 0, m_in_len = 0;
+
+        static int64_t result(ssize_t n) { return n < 0 ? -errno : n; }
+
+    public :
+        VMIO(VMTape& tape, bool buffered) : m_tape(tape), m_buffered(buffered) {}
+
+        int64_t print(uint64_t addr, uint64_t len) {
+            if (!m_tape.contains(addr, len)) return -EFAULT;
+            if (!m_buffered) return result(write(1, &m_tape[addr], len));
+            if (m_out_len + len > IO_BUFFER_SIZE) {
+                flush();
+                if (len >= IO_BUFFER_SIZE) return result(write(1, &m_tape[addr], len));
+            }
+            memcpy(m_out + m_out_len, &m_tape[addr], len);
+            m_out_len += len;
+            return len;
+        }
+
+        int64_t read(uint64_t addr, uint64_t len) {
+            if (!m_tape.contains(addr, len)) return -EFAULT;
+            if (!m_buffered) return result(::read(0, &m_tape[addr], len));
+            if (!len) return 0;
+            flush();
+            if (m_in_pos == m_in_len) {
+                if (len >= IO_BUFFER_SIZE) return result(::read(0, &m_tape[addr], len));
+                ssize_t n = ::read(0, m_in, IO_BUFFER_SIZE);
+                if (n <= 0) return result(n);
+                m_in_pos = 0;
+                m_in_len = n;
+            }
+            len = min(len, m_in_len - m_in_pos);
+            memcpy(&m_tape[addr], m_in + m_in_pos, len);
+            m_in_pos += len;
+            return len;
+        }
+
+        int64_t flush() {
+            size_t written = 0;
+            while (written < m_out_len) {
+                ssize_t n = write(1, m_out + written, m_out_len - written);
+                if (n <= 0) {
+                    m_out_len = 0;
+                    return result(n);
+                }
+                written += n;
+            }
+            m_out_len = 0;
+            return written;
+        }
+};
+
+// une plage hors du tape arrête le programme comme le code natif, par SIGSEGV
+static int64_t vm_memcpy(VMTape& tape, uint64_t dst, uint64_t src, uint64_t len) {
+    if (!tape.contains(dst, len) || !tape.contains(src, len)) raise(SIGSEGV);
+    // octet par octet en avançant, comme rep movsb, si la source est recouverte
+    if (dst > src && dst < src + len)
+        for (uint64_t i = 0; i < len; i++) tape[dst+i] = tape[src+i];
+    else if (len)
+        memmove(&tape[dst], &tape[src], len);
+    return len;
+}
+
+static int64_t vm_memset(VMTape& tape, uint64_t dst, int64_t byte, uint64_t len) {
+    if (!tape.contains(dst, len)) raise(SIGSEGV);
+    if (len) memset(&tape[dst], (uint8_t)byte, len);
+    return len;
+}
+
+static int64_t vm_memchr(const VMTape& tape, uint64_t addr, uint64_t len, int64_t byte) {
+    if (!tape.contains(addr, len)) raise(SIGSEGV);
+    const void* found = len ? memchr(&tape[addr], (uint8_t)byte, len) : nullptr;
+    return found ? (const uint8_t*)found - &tape[addr] : -1;
+}
+
+static int64_t vm_memcmp(const VMTape& tape, uint64_t a, uint64_t b, uint64_t len) {
+    if (!tape.contains(a, len) || !tape.contains(b, len)) raise(SIGSEGV);
+    for (uint64_t i = 0; i < len; i++)
+        if (tape[a+i] != tape[b+i]) return (int64_t)tape[a+i] - tape[b+i];
+    return 0;
+}
+
+// pile des cadres, de la taille de la pile du code natif
+class VMStack{
+    private :
+        int64_t* m_base;
+        size_t m_size;
+    public :
+        VMStack() {
+            struct rlimit limit;
+            getrlimit(RLIMIT_STACK, &limit);
+            m_size = limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > (1ull << 36)
+                ? 1ull << 36 : limit.rlim_cur;
+            // réservée seulement : les pages sont allouées à la première écriture
+            void* mem = mmap(nullptr, m_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (mem == MAP_FAILED) throw runtime_error("cannot map the VM stack");
+            m_base = (int64_t*)mem;
+        }
+        ~VMStack() { munmap(m_base, m_size); }
+        int64_t* begin() const { return m_base; }
+        // une marge reste au-delà pour l'en-tête et les arguments de l'appel
+        // qui précède la vérification de BC_ENTER
+        int64_t* end() const { return m_base + m_size/sizeof(int64_t) - (1 << 16); }
+};
+
+int64_t run_bytecode(const Bytecode& bc, bool buffered_io) {
+    // threading direct : l'opcode de chaque instruction est remplacé par
+    // l'adresse du code qui l'exécute
+    static void* const handlers[BC_OPS_NB] = {
+        &&op_ENTER, &&op_MOV_R, &&op_MOV_I, &&op_ARG,
+#define X(op) &&op_##op##_RR, &&op_##op##_RI,
+        BC_BINOPS(X)
+#undef X
+        &&op_LOAD_R, &&op_LOAD_I, &&op_STORE_R, &&op_STORE_I,
+        &&op_LOADW_R, &&op_LOADW_I, &&op_STOREW_R, &&op_STOREW_I, &&op_MLOAD, &&op_MSTORE,
+        &&op_PRINT, &&op_READ, &&op_FLUSH, &&op_MEMCPY, &&op_MEMSET, &&op_MEMCHR, &&op_MEMCMP,
+        &&op_CALL, &&op_TAILCALL, &&op_RET_R, &&op_RET_I, &&op_JMP,
+#define X(cond) &&op_BR_##cond##_RR, &&op_BR_##cond##_RI,
+        BC_CONDS(X)
+#undef X
+    };
+    vector<int64_t> threaded = bc.code;
+    for (size_t pos = 0; pos < threaded.size(); pos += instr_size(&bc.code[pos])) {
+        if (bc.code[pos] < 0 || bc.code[pos] >= BC_OPS_NB)
+            throw runtime_error("invalid bytecode");
+        threaded[pos] = (int64_t)handlers[bc.code[pos]];
+    }
+    const int64_t* code = threaded.data();
+
+    VMTape tape{bc.tape};
+    const uint64_t tape_size = tape.size();
+    vector<int64_t> memo(bc.memo_size/8, 0);
+    VMIO io{tape, buffered_io};
+    VMStack stack;
+    // un cadre est précédé de l'en-tête (retour, fp, ap, dst de l'appelant)
+    // et des arguments, ap pointant sur le premier ; fp pointe sur le
+    // premier registre
+    int64_t* ap = stack.begin() + 4;
+    int64_t* fp = ap;
+    ap[-4] = 0;
+    const int64_t* pc = code + bc.entry;
+    int64_t res;
+
+#define NEXT goto *(void*)*pc
+#define R(i) fp[pc[i]]
+
+    NEXT;
+
+op_ENTER:
+    if (fp + pc[1] > stack.end()) raise(SIGSEGV);
+    pc += 2;
+    NEXT;
+op_MOV_R:
+    R(1) = R(2);
+    pc += 3;
+    NEXT;
+op_MOV_I:
+    R(1) = pc[2];
+    pc += 3;
+    NEXT;
+op_ARG:
+    R(1) = ap[pc[2]];
+    pc += 3;
+    NEXT;
+
+#define BINOP(op, expr) \
+op_##op##_RR: { int64_t a = R(2), b = R(3); R(1) = (expr); pc += 4; NEXT; } \
+op_##op##_RI: { int64_t a = R(2), b = pc[3]; R(1) = (expr); pc += 4; NEXT; }
+    BINOP(ADD, wrap_add(a, b))
+    BINOP(SUB, wrap_sub(a, b))
+    BINOP(MUL, wrap_mul(a, b))
+    BINOP(DIV, vm_div(a, b))
+    BINOP(MOD, vm_mod(a, b))
+    BINOP(SHL, (int64_t)((uint64_t)a << (b & 63)))
+    BINOP(SHR, (int64_t)((uint64_t)a >> (b & 63)))
+    BINOP(AND, a & b)
+    BINOP(OR, a | b)
+    BINOP(EQ, a == b)
+    BINOP(NE, a != b)
+    BINOP(LT, a < b)
+    BINOP(LE, a <= b)
+    BINOP(GT, a > b)
+    BINOP(GE, a >= b)
+#undef BINOP
+
+    // le code natif s'arrête sur la page de garde qui suit le tape ; ici
+    // chaque adresse est vérifiée pour ne pas corrompre la machine virtuelle
+op_LOAD_R:
+    if ((uint64_t)R(2) >= tape_size) raise(SIGSEGV);
+    R(1) = tape[R(2)];
+    pc += 3;
+    NEXT;
+op_LOAD_I:
+    if ((uint64_t)pc[2] >= tape_size) raise(SIGSEGV);
+    R(1) = tape[pc[2]];
+    pc += 3;
+    NEXT;
+op_STORE_R:
+    if ((uint64_t)R(1) >= tape_size) raise(SIGSEGV);
+    tape[R(1)] = R(2);
+    pc += 3;
+    NEXT;
+op_STORE_I:
+    if ((uint64_t)pc[1] >= tape_size) raise(SIGSEGV);
+    tape[pc[1]] = R(2);
+    pc += 3;
+    NEXT;
+op_LOADW_R:
+    if (!tape.contains(R(2), pc[3])) raise(SIGSEGV);
+    R(1) = load_le(&tape[R(2)], pc[3]);
+    pc += 4;
+    NEXT;
+op_LOADW_I:
+    if (!tape.contains(pc[2], pc[3])) raise(SIGSEGV);
+    R(1) = load_le(&tape[pc[2]], pc[3]);
+    pc += 4;
+    NEXT;
+op_STOREW_R:
+    if (!tape.contains(R(1), pc[3])) raise(SIGSEGV);
+    store_le(&tape[R(1)], R(2), pc[3]);
+    pc += 4;
+    NEXT;
+op_STOREW_I:
+    if (!tape.contains(pc[1], pc[3])) raise(SIGSEGV);
+    store_le(&tape[pc[1]], R(2), pc[3]);
+    pc += 4;
+    NEXT;
+op_MLOAD:
+    if ((uint64_t)R(2) >= (uint64_t)bc.memo_size) raise(SIGSEGV);
+    R(1) = memo[R(2) >> 3];
+    pc += 3;
+    NEXT;
+op_MSTORE:
+    if ((uint64_t)R(1) >= (uint64_t)bc.memo_size) raise(SIGSEGV);
+    memo[R(1) >> 3] = R(2);
+    pc += 3;
+    NEXT;
+op_PRINT:
+    R(1) = io.print(R(2), R(3));
+    pc += 4;
+    NEXT;
+op_READ:
+    R(1) = io.read(R(2), R(3));
+    pc += 4;
+    NEXT;
+op_FLUSH:
+    R(1) = buffered_io ? io.flush() : 0;
+    pc += 2;
+    NEXT;
+op_MEMCPY:
+    R(1) = vm_memcpy(tape, R(2), R(3), R(4));
+    pc += 5;
+    NEXT;
+op_MEMSET:
+    R(1) = vm_memset(tape, R(2), R(3), R(4));
+    pc += 5;
+    NEXT;
+op_MEMCHR:
+    R(1) = vm_memchr(tape, R(2), R(3), R(4));
+    pc += 5;
+    NEXT;
+op_MEMCMP:
+    R(1) = vm_memcmp(tape, R(2), R(3), R(4));
+    pc += 5;
+    NEXT;
+
+op_CALL: {
+    int64_t* header = fp + pc[3];
+    int64_t n = pc[4];
+    int64_t* args = header + 4;
+    for (int64_t i = 0; i < n; i++)
+        args[i] = pc[5 + 2*i] ? pc[6 + 2*i] : fp[pc[6 + 2*i]];
+    header[0] = (int64_t)(pc + 5 + 2*n);
+    header[1] = (int64_t)fp;
+    header[2] = (int64_t)ap;
+    header[3] = pc[2];
+    ap = args;
+    fp = args + n;
+    pc = code + pc[1];
+    NEXT;
+}
+op_TAILCALL: {
+    // les nouveaux arguments remplacent les nôtres, qu'ils peuvent lire :
+    // ils sont d'abord calculés au-dessus du cadre
+    int64_t n = pc[3];
+    int64_t* tmp = fp + pc[2];
+    for (int64_t i = 0; i < n; i++)
+        tmp[i] = pc[4 + 2*i] ? pc[5 + 2*i] : fp[pc[5 + 2*i]];
+    for (int64_t i = 0; i < n; i++)
+        ap[i] = tmp[i];
+    fp = ap + n;
+    pc = code + pc[1];
+    NEXT;
+}
+op_RET_R:
+    res = R(1);
+    goto ret;
+op_RET_I:
+    res = pc[1];
+ret: {
+    int64_t* header = ap - 4;
+    if (!header[0]) {
+        io.flush();
+        return res;
+    }
+    pc = (const int64_t*)header[0];
+    fp = (int64_t*)header[1];
+    ap = (int64_t*)header[2];
+    fp[header[3]] = res;
+    NEXT;
+}
+op_JMP:
+    pc = code + pc[1];
+    NEXT;
+
+#define BRANCH(cond, op) \
+op_BR_##cond##_RR: pc = code + (R(1) op R(2) ? pc[3] : pc[4]); NEXT; \
+op_BR_##cond##_RI: pc = code + (R(1) op pc[2] ? pc[3] : pc[4]); NEXT;
+    BRANCH(EQ, ==)
+    BRANCH(NE, !=)
+    BRANCH(LT, <)
+    BRANCH(LE, <=)
+    BRANCH(GT, >)
+    BRANCH(GE, >=)
+#undef BRANCH
+#undef R
+#undef NEXT
+}
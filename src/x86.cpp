@@ -0,0 +1,73 @@
+#include "x86.h"
+
+static const char* const reg_names[5][16] = {
+    {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+     "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"},
+    {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+     "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"},
+    {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+     "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"},
+    {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+     "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"},
+    {"xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+     "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"}
+};
+
+static const char* const mop_names[] = {
+    "", "mov", "movzx", "lea",
+    "add", "sub", "imul", "mul", "idiv", "neg", "shl", "shr", "and", "or", "xor", "cmp", "test", "bsf",
+    "sete", "setne", "setl", "setle", "setg", "setge",
+    "push", "pop",
+    "call", "jmp", "je", "jne", "jl", "jle", "jg", "jge", "ret",
+    "syscall",
+    "rep movsb", "rep stosb",
+    "movq", "movdqu", "punpcklqdq", "pcmpeqb", "pmovmskb"
+};
+
+static int size_log2(int size) {
+    return size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : size == 8 ? 3 : 4;
+}
+
+static void print_operand(ostream& out, const MProgram& prog, const Operand& op) {
+    static const char* const size_names[] = {"BYTE", "WORD", "DWORD", "QWORD", "OWORD"};
+    switch (op.kind) {
+        case Operand::NONE: break;
+        case Operand::REG:
+            out << reg_names[size_log2(op.size)][op.base];
+            break;
+        case Operand::IMM:
+            out << op.val;
+            break;
+        case Operand::LABEL:
+            out << prog.labels[op.val];
+            break;
+        case Operand::MEM:
+            out << size_names[size_log2(op.size)] << " [" << reg_names[3][op.base];
+            if (op.index != NO_REG) out << '+' << reg_names[3][op.index];
+            if (op.val > 0) out << '+' << op.val;
+            else if (op.val < 0) out << op.val;
+            out << ']';
+            break;
+    }
+}
+
+void print_nasm(ostream& out, const MProgram& prog) {
+    out << "section .text\n\n"
+            "global _start\n";
+    for (const MInstr& instr : prog.code) {
+        if (instr.op == MOp::LABEL) {
+            out << '\n' << prog.labels[instr.dst.val] << ":\n";
+            continue;
+        }
+        out << '\t' << mop_names[(int)instr.op];
+        if (instr.dst.kind != Operand::NONE) {
+            out << ' ';
+            print_operand(out, prog, instr.dst);
+        }
+        if (instr.src.kind != Operand::NONE) {
+            out << ", ";
+            print_operand(out, prog, instr.src);
+        }
+        out << '\n';
+    }
+}
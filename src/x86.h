@@ -0,0 +1,107 @@
+#ifndef X86_H
+#define X86_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Sous-ensemble des instructions x86-64 produites par le codegen, avant
+// leur encodage en code machine ou leur écriture en assembleur NASM
+
+enum Reg : uint8_t {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    NO_REG = 0xFF
+};
+
+struct Operand{
+    enum Kind : uint8_t {
+        NONE, REG, IMM, MEM, LABEL
+    } kind = NONE;
+    // taille en octets du registre ou de l'accès mémoire, 16 pour un
+    // registre xmm, dont le numéro est dans base
+    uint8_t size = 8;
+    // REG : le registre, MEM : la base
+    Reg base = NO_REG;
+    // MEM : registre d'index (facteur 1), NO_REG s'il n'y en a pas
+    Reg index = NO_REG;
+    // IMM : la constante, MEM : le déplacement, LABEL : le numéro du label
+    int64_t val = 0;
+
+    bool operator==(const Operand& rhs) const {
+        return kind == rhs.kind && size == rhs.size && base == rhs.base
+            && index == rhs.index && val == rhs.val;
+    }
+    bool operator!=(const Operand& rhs) const { return !(*this == rhs); }
+};
+
+inline Operand reg(Reg r, int size = 8) { return {Operand::REG, (uint8_t)size, r}; }
+inline Operand xmm(int n) { return {Operand::REG, 16, (Reg)n}; }
+inline Operand imm(int64_t val) { return {Operand::IMM, 8, NO_REG, NO_REG, val}; }
+inline Operand mem(Reg base, int32_t disp, int size = 8) {
+    return {Operand::MEM, (uint8_t)size, base, NO_REG, disp};
+}
+inline Operand mem(Reg base, Reg index, int32_t disp, int size) {
+    return {Operand::MEM, (uint8_t)size, base, index, disp};
+}
+inline Operand label(int id) { return {Operand::LABEL, 8, NO_REG, NO_REG, id}; }
+
+inline bool fits_imm32(int64_t val) { return val == (int32_t)val; }
+
+enum class MOp : uint8_t {
+    LABEL,      // pseudo-instruction : définit le label dst
+    MOV, MOVZX, LEA,
+    ADD, SUB, IMUL, MUL, IDIV, NEG, SHL, SHR, AND, OR, XOR, CMP, TEST, BSF,
+    SETE, SETNE, SETL, SETLE, SETG, SETGE,
+    PUSH, POP,
+    CALL, JMP, JE, JNE, JL, JLE, JG, JGE, RET,
+    SYSCALL,
+    // copie ou remplit rcx octets en avançant depuis rsi ou avec al vers rdi
+    REP_MOVSB, REP_STOSB,
+    // SSE2, présent sur tout processeur x86-64 : movq d'un registre général
+    // vers xmm, movdqu d'un accès mémoire de 16 octets non aligné vers xmm
+    MOVQ, MOVDQU, PUNPCKLQDQ, PCMPEQB, PMOVMSKB
+};
+
+struct MInstr{
+    MOp op;
+    Operand dst, src;
+};
+
+struct MProgram{
+    vector<MInstr> code;
+    vector<string> labels;
+    int entry = -1;
+
+    int new_label(string name) {
+        labels.push_back(std::move(name));
+        return labels.size()-1;
+    }
+    void emit(MOp op, Operand dst = {}, Operand src = {}) {
+        code.push_back({op, dst, src});
+    }
+};
+
+void print_nasm(ostream& out, const MProgram& prog);
+
+// code machine d'un programme, sans relocation : tous les sauts et appels
+// sont relatifs
+struct MachineCode{
+    vector<uint8_t> text;
+    // position du point d'entrée dans text
+    size_t entry = 0;
+};
+
+MachineCode encode(const MProgram& prog);
+// écrit un exécutable ELF64 statique, comme le ferait ld
+void write_elf(const char* path, const MachineCode& code);
+// copie le code dans une zone exécutable et appelle son point d'entrée,
+// qui doit retourner comme une fonction C et reçoit en argument le sommet
+// d'une pile neuve et l'adresse où signaler un échec de projection du
+// tape, qui lève IOError
+int64_t run_jit(const MachineCode& code);
+
+#endif
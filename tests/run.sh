@@ -0,0 +1,73 @@
+#!/bin/sh
+# Tests de non-régression. Chaque programme du dossier doit compiler, avec
+# et sans optimisations ; si nom.status existe, le programme est aussi
+# exécuté en natif, par --run et par --vm, et chaque statut de sortie est
+# comparé à celui du fichier, ainsi que celui du bytecode enregistré puis
+# rechargé. Des fichiers de bytecode invalides doivent être refusés au
+# chargement.
+# usage : tests/run.sh [compilateur]
+TIPE=$(realpath "${1:-./build/tipe}")
+DIR=$(realpath "$(dirname "$0")")
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+fail=0
+check() {
+    [ "$2" = "$3" ] || { echo "$1: $4 exited with $2, expected $3"; fail=1; }
+}
+for f in "$DIR"/*.tipe; do
+    name=$(basename "$f" .tipe)
+    for opt in -O0 ""; do
+        rm -f a.out
+        "$TIPE" $opt "$f" >/dev/null 2>&1
+        status=$?
+        check "$name" $status 0 "tipe $opt"
+        [ $status = 0 ] && [ -f "$DIR/$name.status" ] || continue
+        expected=$(cat "$DIR/$name.status")
+        ./a.out </dev/null >/dev/null 2>&1
+        check "$name" $? "$expected" "a.out ($opt)"
+    done
+    [ -f "$DIR/$name.status" ] || continue
+    for mode in --run --vm; do
+        "$TIPE" $mode "$f" </dev/null >/dev/null 2>&1
+        check "$name" $? "$expected" "tipe $mode"
+    done
+    rm -f out.tbc
+    "$TIPE" --emit-bytecode "$f" >/dev/null 2>&1
+    "$TIPE" out.tbc </dev/null >/dev/null 2>&1
+    check "$name" $? "$expected" "out.tbc"
+done
+
+# mots de 64 bits en little endian
+words() {
+    for w in "$@"; do
+        i=0
+        while [ $i -lt 8 ]; do
+            printf "\\$(printf %o $(( (w >> (8*i)) & 255 )))"
+            i=$((i + 1))
+        done
+    done
+}
+# bytecode nom entry mots... : en-tête TIPEBC4 avec un tape de 81920 octets,
+# puis le code, qui doit être refusé
+bytecode() {
+    name=$1 entry=$2
+    shift 2
+    { printf 'TIPEBC4\0'; words "$entry" 0 81920 0 $#; words "$@"; } > "$name.tbc"
+    "$TIPE" "$name.tbc" </dev/null >"$name.err" 2>&1
+    status=$?
+    grep -q "not a bytecode file" "$name.err" || check "$name.tbc" $status "a rejection" "tipe"
+}
+# ENTER 1 ; RET_I 0, seul fichier valide, pour vérifier l'encodage
+{ printf 'TIPEBC4\0'; words 0 0 81920 0 4 0 1 54 0; } > valid.tbc
+"$TIPE" valid.tbc </dev/null >/dev/null 2>&1
+check valid.tbc $? 0 tipe
+bytecode no_terminator 0 0 1
+bytecode far_register 0 0 1 1 100000000 0 54 0
+bytecode truncated_instr 0 0 1 1 0
+bytecode mid_instr_jump 0 0 1 55 1
+bytecode other_func_jump 0 0 1 55 4 0 1 54 0
+bytecode call_not_enter 0 0 3 51 2 0 3 0 54 0
+bytecode bad_width 0 0 2 38 0 0 3 54 0
+bytecode main_arg 0 0 2 3 0 0 54 0
+exit $fail